@@ -1,16 +1,70 @@
+#pragma once
+
 #include <stddef.h>
 
+#include <algorithm>
+#include <bit>
+#include <compare>
+#include <cstdint>
+#include <cstring>
+#include <functional>
 #include <iostream>
 #include <iterator>
+#include <memory>
+#include <numeric>
+#include <span>
 #include <type_traits>
+#include <utility>
+
+// Block size policies for Deque. block_size<T>() must be a power of two so
+// that element addressing reduces to a shift and a mask.
+template <size_t Bytes>
+struct DequeBlockBytes {
+  template <typename T>
+  static constexpr size_t block_size() {
+    size_t count = 1;
+    while (2 * count * sizeof(T) <= Bytes) {
+      count *= 2;
+    }
+    return count;
+  }
+};
+
+template <size_t Count>
+struct DequeBlockElements {
+  static_assert(Count > 0 && (Count & (Count - 1)) == 0,
+                "Deque block size must be a power of two");
 
-template <typename T>
+  template <typename T>
+  static constexpr size_t block_size() {
+    return Count;
+  }
+};
+
+template <typename T, typename Alloc = std::allocator<T>,
+          typename BlockPolicy = DequeBlockBytes<512>>
 class Deque {
  private:
+  using AllocTraits = std::allocator_traits<Alloc>;
+  using MapAlloc = typename AllocTraits::template rebind_alloc<T*>;
+  using MapTraits = std::allocator_traits<MapAlloc>;
+
+  [[no_unique_address]] Alloc alloc_;
   T** outer_array_ = nullptr;
   size_t sz_ = 0;
   size_t cap_ = 0;
-  static const size_t block_sz_ = 16;
+  T* spare_blocks_ = nullptr;
+  size_t spare_cnt_ = 0;
+  size_t max_spare_blocks_ = SIZE_MAX;
+  static constexpr size_t block_sz_ =
+      BlockPolicy::template block_size<T>();
+  static constexpr size_t block_shift_ = std::countr_zero(block_sz_);
+  static constexpr size_t block_mask_ = block_sz_ - 1;
+
+  static_assert(block_sz_ == (size_t(1) << block_shift_),
+                "Deque block size must be a power of two");
+  static_assert(block_sz_ * sizeof(T) >= sizeof(T*),
+                "Deque blocks must be able to hold a free-list link");
 
   struct Position {
     int64_t row = 0;
@@ -18,23 +72,19 @@ class Deque {
 
     Position() = default;
 
-    Position(ssize_t x, ssize_t y) : row(x), column(y) {}
+    Position(int64_t x, int64_t y) : row(x), column(y) {}
 
     Position& operator++() {
       ++column;
-      if (column == block_sz_) {
-        column = 0;
-        ++row;
-      }
+      row += column >> block_shift_;
+      column &= block_mask_;
       return *this;
     }
 
     Position& operator--() {
       --column;
-      if (column < 0) {
-        column = block_sz_ - 1;
-        --row;
-      }
+      row += column >> block_shift_;
+      column &= block_mask_;
       return *this;
     }
   };
@@ -42,90 +92,459 @@ class Deque {
   Position begin_;
   Position end_;
 
+  T** allocate_map(size_t cap) {
+    if (cap == 0) {
+      return nullptr;
+    }
+    MapAlloc map_alloc = alloc_;
+    return MapTraits::allocate(map_alloc, cap);
+  }
+
+  void deallocate_map(T** map, size_t cap) {
+    if (map == nullptr) {
+      return;
+    }
+    MapAlloc map_alloc = alloc_;
+    MapTraits::deallocate(map_alloc, map, cap);
+  }
+
+  T* allocate_block() { return AllocTraits::allocate(alloc_, block_sz_); }
+
+  void deallocate_block(T* block) {
+    AllocTraits::deallocate(alloc_, block, block_sz_);
+  }
+
+  void swap_storage(Deque& other) noexcept {
+    std::swap(spare_blocks_, other.spare_blocks_);
+    std::swap(spare_cnt_, other.spare_cnt_);
+    std::swap(max_spare_blocks_, other.max_spare_blocks_);
+    std::swap(cap_, other.cap_);
+    std::swap(sz_, other.sz_);
+    std::swap(outer_array_, other.outer_array_);
+    std::swap(begin_, other.begin_);
+    std::swap(end_, other.end_);
+  }
+
+  // Blocks are allocated on first touch. Rows outside
+  // [begin_.row, end_.row] are null; blocks drained by pop_* are kept on
+  // spare_blocks_, a list threaded through the raw blocks themselves, until
+  // it holds max_spare_blocks_ of them. Further blocks go back to the
+  // allocator.
+  T* take_block() {
+    if (spare_blocks_ == nullptr) {
+      return allocate_block();
+    }
+    T* block = spare_blocks_;
+    std::memcpy(&spare_blocks_, block, sizeof(T*));
+    --spare_cnt_;
+    return block;
+  }
+
+  void release_row(int64_t row) {
+    T* block = outer_array_[row];
+    outer_array_[row] = nullptr;
+    if (spare_cnt_ >= max_spare_blocks_) {
+      deallocate_block(block);
+      return;
+    }
+    std::memcpy(static_cast<void*>(block), &spare_blocks_, sizeof(T*));
+    spare_blocks_ = block;
+    ++spare_cnt_;
+  }
+
+  void ensure_row(int64_t row) {
+    if (outer_array_[row] == nullptr) {
+      outer_array_[row] = take_block();
+    }
+  }
+
+  void trim_spares(size_t limit) {
+    while (spare_cnt_ > limit) {
+      T* block = spare_blocks_;
+      std::memcpy(&spare_blocks_, block, sizeof(T*));
+      deallocate_block(block);
+      --spare_cnt_;
+    }
+  }
+
+  // Frees the whole spare list oldest block first. Drained blocks then go
+  // back roughly in the order they were allocated, which lets the
+  // allocator coalesce them and return the memory to the system.
+  void free_spares() {
+    T* oldest = nullptr;
+    while (spare_blocks_ != nullptr) {
+      T* block = spare_blocks_;
+      std::memcpy(&spare_blocks_, block, sizeof(T*));
+      std::memcpy(static_cast<void*>(block), &oldest, sizeof(T*));
+      oldest = block;
+    }
+    spare_blocks_ = oldest;
+    trim_spares(0);
+  }
+
+  void release_storage() {
+    for (size_t i = 0; i < cap_; ++i) {
+      if (outer_array_[i] != nullptr) {
+        deallocate_block(outer_array_[i]);
+      }
+    }
+    free_spares();
+    deallocate_map(outer_array_, cap_);
+    outer_array_ = nullptr;
+    cap_ = 0;
+    begin_ = {0, 0};
+    end_ = begin_;
+    --end_;
+  }
+
+  void init_storage(size_t cap) {
+    outer_array_ = allocate_map(cap);
+    std::fill(outer_array_, outer_array_ + cap, nullptr);
+    cap_ = cap;
+    begin_ = {0, 0};
+    end_ = begin_;
+    --end_;
+  }
+
+  template <typename... Args>
+  void construct_back(Args&&... args) {
+    Position next = end_;
+    ++next;
+    ensure_row(next.row);
+    AllocTraits::construct(alloc_, outer_array_[next.row] + next.column,
+                           std::forward<Args>(args)...);
+    end_ = next;
+    ++sz_;
+  }
+
+  template <typename... Args>
+  void construct_front(Args&&... args) {
+    Position prev = begin_;
+    --prev;
+    ensure_row(prev.row);
+    AllocTraits::construct(alloc_, outer_array_[prev.row] + prev.column,
+                           std::forward<Args>(args)...);
+    begin_ = prev;
+    ++sz_;
+  }
+
+  void destroy_all() {
+    if constexpr (!std::is_trivially_destructible<T>::value) {
+      for (std::span<T> segment : segments()) {
+        for (T& value : segment) {
+          AllocTraits::destroy(alloc_, &value);
+        }
+      }
+    }
+    sz_ = 0;
+  }
+
   void resize(size_t cap, bool front) {
-    size_t help = 0;
     size_t newcap = (cap == 0) ? 4 : 2 * cap;
-    T** newarr;
+    T** newarr = allocate_map(newcap);
+    std::fill(newarr, newarr + newcap, nullptr);
+    size_t offset = front ? newcap - cap_ : 0;
+    std::copy(outer_array_, outer_array_ + cap_, newarr + offset);
+    begin_.row += offset;
+    end_.row += offset;
+    deallocate_map(outer_array_, cap_);
+    outer_array_ = newarr;
+    cap_ = newcap;
+  }
+
+  // Moves the rows in use to the middle of the map. A deque that is
+  // pushed at one end and popped at the other drifts towards the edge of
+  // the map; recentering it makes room without doubling the map, and the
+  // drained blocks come back from spare_blocks_.
+  void recenter() {
+    size_t used = end_.row - begin_.row + 1;
+    int64_t start = (cap_ - used) / 2;
+    if (start < begin_.row) {
+      std::rotate(outer_array_, outer_array_ + (begin_.row - start),
+                  outer_array_ + cap_);
+    } else {
+      std::rotate(outer_array_, outer_array_ + cap_ - (start - begin_.row),
+                  outer_array_ + cap_);
+    }
+    end_.row += start - begin_.row;
+    begin_.row = start;
+  }
+
+  void make_room(bool front) {
+    if (sz_ == 0) {
+      if (cap_ < 4) {
+        resize(cap_, front);
+      }
+      begin_ = {static_cast<int64_t>(cap_ / 2), 0};
+      end_ = begin_;
+      --end_;
+      return;
+    }
+    size_t used = end_.row - begin_.row + 1;
+    if (cap_ >= 2 * (used + 2)) {
+      recenter();
+    } else {
+      resize(cap_, front);
+    }
+  }
+
+  // Keeps a spare row after the one holding the new back element so that
+  // end() always has a block to point into.
+  void reserve_back() {
+    Position next = end_;
+    ++next;
+    if (sz_ == 0 || next.row + 1 >= static_cast<int64_t>(cap_)) {
+      make_room(false);
+    }
+  }
+
+  void reserve_front() {
+    Position prev = begin_;
+    --prev;
+    if (sz_ == 0 || prev.row < 0) {
+      make_room(true);
+    }
+  }
+
+  static Position shifted(Position pos, ptrdiff_t offset) {
+    int64_t flat = (pos.row << block_shift_) + pos.column + offset;
+    return {flat >> block_shift_, static_cast<int64_t>(flat & block_mask_)};
+  }
+
+  // Multi-element counterpart of reserve_front/reserve_back.
+  void reserve_elements(size_t count, bool front) {
+    if (sz_ == 0) {
+      make_room(front);
+    }
+    auto fits = [&] {
+      return front ? shifted(begin_, -static_cast<ptrdiff_t>(count)).row >= 0
+                   : shifted(end_, count).row + 1 <
+                         static_cast<int64_t>(cap_);
+    };
+    if (fits()) {
+      return;
+    }
+    size_t used = end_.row - begin_.row + 1;
+    size_t rows = count / block_sz_ + 1;
+    while (cap_ < 2 * (used + rows + 2)) {
+      resize(cap_, front);
+    }
+    if (!fits()) {
+      recenter();
+    }
+  }
+
+  // Moves count elements from index src to index dst a block-contiguous
+  // run at a time: memmove for trivially copyable T, move assignment
+  // otherwise. Both ranges must consist of live elements unless T is
+  // trivially copyable.
+  void move_elements(size_t src, size_t dst, size_t count) {
+    if (count == 0 || src == dst) {
+      return;
+    }
+    bool forward = dst < src;
+    while (count > 0) {
+      size_t from = forward ? src : src + count - 1;
+      size_t to = forward ? dst : dst + count - 1;
+      size_t from_column = (begin_.column + from) & block_mask_;
+      size_t to_column = (begin_.column + to) & block_mask_;
+      size_t run = forward ? std::min({count, block_sz_ - from_column,
+                                       block_sz_ - to_column})
+                           : std::min({count, from_column + 1, to_column + 1});
+      T* src_ptr = &(*this)[forward ? from : from + 1 - run];
+      T* dst_ptr = &(*this)[forward ? to : to + 1 - run];
+      if constexpr (std::is_trivially_copyable<T>::value) {
+        std::memmove(static_cast<void*>(dst_ptr), src_ptr, run * sizeof(T));
+      } else if (forward) {
+        std::move(src_ptr, src_ptr + run, dst_ptr);
+      } else {
+        std::move_backward(src_ptr, src_ptr + run, dst_ptr + run);
+      }
+      if (forward) {
+        src += run;
+        dst += run;
+      }
+      count -= run;
+    }
+  }
+
+  // Constructs count elements from first into the raw slots starting at
+  // start, a block at a time. A run is a single memcpy when T is trivially
+  // copyable and the source is contiguous. Nothing is left constructed if
+  // an element constructor throws.
+  template <typename ForwardIt>
+  void construct_range(Position start, ForwardIt first, size_t count) {
+    constexpr bool bitwise =
+        std::is_trivially_copyable<T>::value &&
+        std::contiguous_iterator<ForwardIt> &&
+        std::is_same<std::iter_value_t<ForwardIt>, T>::value;
+    size_t built = 0;
     try {
-      newarr = new T*[newcap];
-      for (size_t i = 0; i < newcap; ++i) {
-        newarr[i] = reinterpret_cast<T*>(new char[block_sz_ * sizeof(T)]);
-        ++help;
+      while (built < count) {
+        Position pos = shifted(start, built);
+        ensure_row(pos.row);
+        T* place = outer_array_[pos.row] + pos.column;
+        size_t run = std::min(count - built, block_sz_ - pos.column);
+        if constexpr (bitwise) {
+          std::memcpy(static_cast<void*>(place), std::to_address(first),
+                      run * sizeof(T));
+          first += run;
+          built += run;
+        } else {
+          for (size_t i = 0; i < run; ++i, ++first, ++built) {
+            AllocTraits::construct(alloc_, place + i, *first);
+          }
+        }
       }
     } catch (...) {
-      for (size_t i = 0; i < help; ++i) {
-        delete[] reinterpret_cast<char*>(newarr[i]);
+      for (size_t i = 0; i < built; ++i) {
+        Position pos = shifted(start, i);
+        AllocTraits::destroy(alloc_, outer_array_[pos.row] + pos.column);
       }
-      delete[] newarr;
       throw;
     }
-    if (front) {
-      for (size_t i = 0; i < cap_; ++i) {
-        newarr[i + cap_] = outer_array_[i];
+  }
+
+  template <typename ForwardIt>
+  void append_n(ForwardIt first, size_t count) {
+    if (count == 0) {
+      return;
+    }
+    reserve_elements(count, false);
+    Position start = end_;
+    ++start;
+    construct_range(start, first, count);
+    end_ = shifted(start, count - 1);
+    sz_ += count;
+  }
+
+  template <typename ForwardIt>
+  void prepend_n(ForwardIt first, size_t count) {
+    if (count == 0) {
+      return;
+    }
+    reserve_elements(count, true);
+    Position start = shifted(begin_, -static_cast<ptrdiff_t>(count));
+    construct_range(start, first, count);
+    begin_ = start;
+    sz_ += count;
+  }
+
+  // Inserts the count values of [first, first + count) before index,
+  // shifting whichever side of index is shorter.
+  template <typename ForwardIt>
+  void insert_n(size_t index, ForwardIt first, size_t count) {
+    if (count == 0) {
+      return;
+    }
+    if (index == sz_) {
+      append_n(first, count);
+      return;
+    }
+    if (index == 0) {
+      prepend_n(first, count);
+      return;
+    }
+    size_t tail = sz_ - index;
+    if (index < tail) {
+      reserve_elements(count, true);
+      Position new_begin = shifted(begin_, -static_cast<ptrdiff_t>(count));
+      size_t built = 0;
+      try {
+        for (; built < count; ++built) {
+          Position pos = shifted(new_begin, built);
+          ensure_row(pos.row);
+          T* place = outer_array_[pos.row] + pos.column;
+          if (built < index) {
+            AllocTraits::construct(alloc_, place, std::move((*this)[built]));
+          } else {
+            AllocTraits::construct(alloc_, place, *first);
+            ++first;
+          }
+        }
+      } catch (...) {
+        for (size_t i = 0; i < built; ++i) {
+          Position pos = shifted(new_begin, i);
+          AllocTraits::destroy(alloc_, outer_array_[pos.row] + pos.column);
+        }
+        throw;
+      }
+      begin_ = new_begin;
+      sz_ += count;
+      if (index > count) {
+        move_elements(2 * count, count, index - count);
+      }
+      for (size_t i = std::max(count, index); i < index + count; ++i) {
+        (*this)[i] = *first;
+        ++first;
       }
-      begin_.row += cap_;
-      end_.row += cap_;
     } else {
-      for (size_t i = 0; i < cap_; ++i) {
-        newarr[i] = outer_array_[i];
+      reserve_elements(count, false);
+      size_t old_sz = sz_;
+      size_t reused = std::min(tail, count);
+      ForwardIt mid = std::next(first, reused);
+      for (size_t i = reused; i < count; ++i, ++mid) {
+        construct_back(*mid);
+      }
+      for (size_t i = std::max(old_sz, index + count); i < old_sz + count;
+           ++i) {
+        construct_back(std::move((*this)[i - count]));
+      }
+      if (tail > count) {
+        move_elements(index, index + count, tail - count);
+      }
+      for (size_t i = index; i < index + reused; ++i, ++first) {
+        (*this)[i] = *first;
       }
     }
-    delete[] outer_array_;
-    outer_array_ = newarr;
-    cap_ = newcap;
   }
 
  public:
-  Deque<T>() = default;
+  using allocator_type = Alloc;
 
-  Deque<T>(const Deque<T>& other) {
-    try {
-      outer_array_ = new T*[other.cap_];
-      for (size_t i = 0; i < other.cap_; ++i) {
-        outer_array_[i] = reinterpret_cast<T*>(new char[block_sz_ * sizeof(T)]);
-        ++cap_;
-      }
-    } catch (...) {
-      for (size_t i = 0; i < cap_; ++i) {
-        delete[] reinterpret_cast<char*>(outer_array_[i]);
-      }
-      delete[] outer_array_;
-      cap_ = 0;
-      throw;
-    }
+  Deque() = default;
+
+  explicit Deque(const Alloc& alloc) : alloc_(alloc) {}
+
+  Deque(const Deque& other)
+      : Deque(other, AllocTraits::select_on_container_copy_construction(
+                         other.alloc_)) {}
+
+  Deque(Deque&& other) noexcept
+      : alloc_(std::move(other.alloc_)),
+        max_spare_blocks_(other.max_spare_blocks_) {
+    swap_storage(other);
+  }
+
+  Deque(const Deque& other, const Alloc& alloc)
+      : alloc_(alloc), max_spare_blocks_(other.max_spare_blocks_) {
+    init_storage(other.cap_);
     begin_ = other.begin_;
-    end_ = other.end_;
+    end_ = begin_;
+    --end_;
     try {
-      for (size_t i = 0; i < other.sz_; ++i) {
-        new (&((*this)[i])) T(other[i]);
-        ++sz_;
+      for (std::span<const T> segment : other.segments()) {
+        Position start = end_;
+        ++start;
+        construct_range(start, segment.data(), segment.size());
+        end_ = shifted(start, segment.size() - 1);
+        sz_ += segment.size();
       }
     } catch (...) {
-      for (size_t i = 0; i < sz_; ++i) {
-        (&((*this)[i]))->~T();
-      }
-      for (size_t i = 0; i < cap_; ++i) {
-        delete[] reinterpret_cast<char*>(outer_array_[i]);
-      }
-      delete[] outer_array_;
-      sz_ = 0;
-      cap_ = 0;
-      begin_ = {0, 0};
-      end_ = {0, 0};
+      destroy_all();
+      release_storage();
       throw;
     }
   }
 
   T& operator[](size_t index) {
-    int x = begin_.row + (begin_.column + index) / block_sz_;
-    int y = (begin_.column + index) % block_sz_;
-    return outer_array_[x][y];
+    size_t pos = begin_.column + index;
+    return outer_array_[begin_.row + (pos >> block_shift_)][pos & block_mask_];
   }
 
   const T& operator[](size_t index) const {
-    int x = begin_.row + (begin_.column + index) / block_sz_;
-    int y = (begin_.column + index) % block_sz_;
-    return outer_array_[x][y];
+    size_t pos = begin_.column + index;
+    return outer_array_[begin_.row + (pos >> block_shift_)][pos & block_mask_];
   }
 
   T& at(size_t index) {
@@ -142,172 +561,182 @@ class Deque {
     return (*this)[index];
   }
 
-  Deque<T>(size_t init_sz) {
-    cap_ = 2 * (init_sz / block_sz_ + 1);
-    size_t help = 0;
-    try {
-      outer_array_ = new T*[cap_];
-      for (size_t i = 0; i < cap_; ++i) {
-        outer_array_[i] = reinterpret_cast<T*>(new char[block_sz_ * sizeof(T)]);
-        ++help;
-      }
-    } catch (...) {
-      for (size_t i = 0; i < help; ++i) {
-        delete[] reinterpret_cast<char*>(outer_array_[i]);
-      }
-      delete[] outer_array_;
-      cap_ = 0;
-      throw;
-    }
-    begin_ = {0, 0};
-    end_ = begin_;
-    for (size_t i = 0; i + 1 < init_sz; ++i) {
-      ++end_;
-    }
+  explicit Deque(size_t init_sz, const Alloc& alloc = Alloc())
+      : alloc_(alloc) {
+    init_storage(2 * (init_sz / block_sz_ + 1));
     if constexpr (std::is_default_constructible<T>::value) {
       try {
         for (size_t i = 0; i < init_sz; ++i) {
-          new (&((*this)[i])) T();
-          ++sz_;
+          construct_back();
         }
       } catch (...) {
-        for (size_t i = 0; i < sz_; ++i) {
-          (&((*this)[i]))->~T();
-        }
-        for (size_t i = 0; i < cap_; ++i) {
-          delete[] reinterpret_cast<char*>(outer_array_[i]);
-        }
-        delete[] outer_array_;
-        sz_ = 0;
-        cap_ = 0;
-        begin_ = {0, 0};
-        end_ = {0, 0};
+        destroy_all();
+        release_storage();
         throw;
       }
     }
   }
 
-  Deque<T>(size_t init_sz, const T& value) {
-    cap_ = 2 * (init_sz / block_sz_ + 1);
-    size_t help = 0;
-    try {
-      outer_array_ = new T*[cap_];
-      for (size_t i = 0; i < cap_; ++i) {
-        outer_array_[i] = reinterpret_cast<T*>(new char[block_sz_ * sizeof(T)]);
-        ++help;
-      }
-    } catch (...) {
-      for (size_t i = 0; i < help; ++i) {
-        delete[] reinterpret_cast<char*>(outer_array_[i]);
-      }
-      delete[] outer_array_;
-      cap_ = 0;
-      throw;
-    }
-    begin_ = {0, 0};
-    end_ = begin_;
-    for (size_t i = 0; i + 1 < init_sz; ++i) {
-      ++end_;
-    }
+  Deque(size_t init_sz, const T& value, const Alloc& alloc = Alloc())
+      : alloc_(alloc) {
+    init_storage(2 * (init_sz / block_sz_ + 1));
     try {
       for (size_t i = 0; i < init_sz; ++i) {
-        new (&((*this)[i])) T(value);
-        ++sz_;
+        construct_back(value);
       }
     } catch (...) {
-      for (size_t i = 0; i < sz_; ++i) {
-        (&((*this)[i]))->~T();
-      }
-      for (size_t i = 0; i < cap_; ++i) {
-        delete[] reinterpret_cast<char*>(outer_array_[i]);
-      }
-      delete[] outer_array_;
-      sz_ = 0;
-      cap_ = 0;
-      begin_ = {0, 0};
-      end_ = {0, 0};
+      destroy_all();
+      release_storage();
       throw;
     }
   }
 
-  void swap(Deque<T>& other) noexcept {
-    std::swap(cap_, other.cap_);
-    std::swap(sz_, other.sz_);
-    std::swap(outer_array_, other.outer_array_);
-    std::swap(begin_, other.begin_);
-    std::swap(end_, other.end_);
+  Alloc get_allocator() const { return alloc_; }
+
+  void swap(Deque& other) noexcept {
+    swap_storage(other);
+    if constexpr (AllocTraits::propagate_on_container_swap::value) {
+      std::swap(alloc_, other.alloc_);
+    }
   }
 
-  Deque<T>& operator=(const Deque<T>& other) {
+  Deque& operator=(const Deque& other) {
     if (this != &other) {
-      Deque<T> temp(other);
-      swap(temp);
+      Deque temp(
+          other,
+          AllocTraits::propagate_on_container_copy_assignment::value
+              ? other.alloc_
+              : alloc_);
+      swap_storage(temp);
+      std::swap(alloc_, temp.alloc_);
+    }
+    return *this;
+  }
+
+  Deque& operator=(Deque&& other) noexcept(
+      AllocTraits::propagate_on_container_move_assignment::value ||
+      AllocTraits::is_always_equal::value) {
+    if (this == &other) {
+      return *this;
+    }
+    if constexpr (AllocTraits::propagate_on_container_move_assignment::value) {
+      Deque temp(std::move(other));
+      swap_storage(temp);
+      std::swap(alloc_, temp.alloc_);
+    } else {
+      Deque temp(alloc_);
+      if (alloc_ == other.alloc_) {
+        temp.swap_storage(other);
+      } else {
+        for (size_t i = 0; i < other.sz_; ++i) {
+          temp.emplace_back(std::move(other[i]));
+        }
+      }
+      swap_storage(temp);
     }
     return *this;
   }
 
   size_t size() const { return sz_; }
 
-  void push_back(const T& value) {
-    Position rem = end_;
-    ++end_;
-    if (end_.row >= static_cast<long>(cap_)) {
-      --end_;
-      if (cap_ == 0) {
-        --end_;
+  bool empty() const { return sz_ == 0; }
+
+  // Destroys every element. Their blocks go to the spare list (subject to
+  // max_spare_blocks()); the map is kept.
+  void clear() {
+    destroy_all();
+    for (size_t i = 0; i < cap_; ++i) {
+      if (outer_array_[i] != nullptr) {
+        release_row(i);
       }
-      resize(cap_, false);
-      ++end_;
-    }
-    try {
-      new (&((*this)[sz_])) T(value);
-      ++sz_;
-    } catch (...) {
-      end_ = rem;
-      throw;
     }
   }
 
-  void push_front(const T& value) {
-    Position rem = begin_;
-    --begin_;
-    if (begin_.row < 0) {
-      ++begin_;
-      if (cap_ == 0) {
-        ++begin_;
-      }
-      resize(cap_, true);
-      --begin_;
+  // Frees every spare block and shrinks the map to the rows in use plus
+  // one on either side; an empty deque gives back all its memory.
+  void shrink_to_fit() {
+    free_spares();
+    if (sz_ == 0) {
+      release_storage();
+      return;
     }
-    try {
-      new (&((*this)[0])) T(value);
-      ++sz_;
-    } catch (...) {
-      begin_ = rem;
-      throw;
+    size_t used = end_.row - begin_.row + 1;
+    size_t newcap = used + 2;
+    if (newcap >= cap_) {
+      return;
     }
+    T** newarr = allocate_map(newcap);
+    std::fill(newarr, newarr + newcap, nullptr);
+    std::copy(outer_array_ + begin_.row, outer_array_ + end_.row + 1,
+              newarr + 1);
+    for (size_t i = 0; i < cap_; ++i) {
+      bool live = static_cast<int64_t>(i) >= begin_.row &&
+                  static_cast<int64_t>(i) <= end_.row;
+      if (!live && outer_array_[i] != nullptr) {
+        deallocate_block(outer_array_[i]);
+      }
+    }
+    deallocate_map(outer_array_, cap_);
+    outer_array_ = newarr;
+    cap_ = newcap;
+    end_.row += 1 - begin_.row;
+    begin_.row = 1;
+  }
+
+  size_t max_spare_blocks() const { return max_spare_blocks_; }
+
+  // Caps how many drained blocks are kept for reuse; the default keeps
+  // all of them. Blocks above the cap are freed right away.
+  void set_max_spare_blocks(size_t count) {
+    max_spare_blocks_ = count;
+    trim_spares(count);
   }
 
+  template <typename... Args>
+  T& emplace_back(Args&&... args) {
+    reserve_back();
+    construct_back(std::forward<Args>(args)...);
+    return (*this)[sz_ - 1];
+  }
+
+  template <typename... Args>
+  T& emplace_front(Args&&... args) {
+    reserve_front();
+    construct_front(std::forward<Args>(args)...);
+    return (*this)[0];
+  }
+
+  void push_back(const T& value) { emplace_back(value); }
+
+  void push_back(T&& value) { emplace_back(std::move(value)); }
+
+  void push_front(const T& value) { emplace_front(value); }
+
+  void push_front(T&& value) { emplace_front(std::move(value)); }
+
   void pop_front() {
-    (*this)[0].~T();
+    AllocTraits::destroy(alloc_, &((*this)[0]));
+    Position old = begin_;
     ++begin_;
     --sz_;
+    if (sz_ == 0 || begin_.row != old.row) {
+      release_row(old.row);
+    }
   }
 
   void pop_back() {
     --sz_;
-    (*this)[sz_].~T();
+    AllocTraits::destroy(alloc_, &((*this)[sz_]));
+    Position old = end_;
     --end_;
+    if (sz_ == 0 || end_.row != old.row) {
+      release_row(old.row);
+    }
   }
 
   ~Deque() {
-    for (size_t i = 0; i < sz_; ++i) {
-      (*this)[i].~T();
-    }
-    for (size_t i = 0; i < cap_; ++i) {
-      delete[] reinterpret_cast<char*>(outer_array_[i]);
-    }
-    delete[] outer_array_;
+    destroy_all();
+    release_storage();
   }
 
   template <bool is_const>
@@ -339,30 +768,18 @@ class Deque {
 
     Pointer operator->() const { return elem_ptr_; }
 
-    base_iterator& operator+=(int shift) {
+    base_iterator& operator+=(difference_type shift) {
       if (shift == 0 || bucket_ptr_ == nullptr) {
         return *this;
       }
-      if (shift > 0) {
-        int rem = elem_ptr_ - *bucket_ptr_;
-        bucket_ptr_ += (shift + rem) / block_sz_;
-        elem_ptr_ = *bucket_ptr_ + (shift + rem) % block_sz_;
-      } else {
-        shift = -shift;
-        if (shift > elem_ptr_ - *bucket_ptr_) {
-          shift -= (elem_ptr_ - *bucket_ptr_) + 1;
-          bucket_ptr_ -= shift / block_sz_ + 1;
-          elem_ptr_ = *bucket_ptr_ + (block_sz_ - shift % block_sz_ - 1);
-        } else {
-          elem_ptr_ -= shift;
-        }
-      }
+      difference_type pos = (elem_ptr_ - *bucket_ptr_) + shift;
+      bucket_ptr_ += pos >> block_shift_;
+      elem_ptr_ = *bucket_ptr_ + (pos & block_mask_);
       return *this;
     }
 
-    base_iterator& operator-=(int shift) {
-      shift = -shift;
-      *this += shift;
+    base_iterator& operator-=(difference_type shift) {
+      *this += -shift;
       return *this;
     }
 
@@ -543,18 +960,237 @@ class Deque {
         outer_array_ + end_.row, outer_array_[end_.row] + end_.column + 1));
   }
 
-  void insert(iterator it, const T& val) {
-    T temp = val;
-    for (iterator iter = it; iter != end(); ++iter) {
-      std::swap(*iter, temp);
+  template <typename... Args>
+  void emplace(iterator it, Args&&... args) {
+    size_t index = it - begin();
+    if (index == sz_) {
+      emplace_back(std::forward<Args>(args)...);
+      return;
+    }
+    if (index == 0) {
+      emplace_front(std::forward<Args>(args)...);
+      return;
     }
-    push_back(temp);
+    T value(std::forward<Args>(args)...);
+    insert_n(index, std::make_move_iterator(&value), 1);
   }
 
-  void erase(iterator it) {
-    for (iterator iter = it; iter + 1 != end(); ++iter) {
-      std::swap(*iter, *(iter + 1));
+  void insert(iterator it, const T& val) { emplace(it, val); }
+
+  void insert(iterator it, T&& val) { emplace(it, std::move(val)); }
+
+  template <typename InputIt,
+            std::enable_if_t<!std::is_integral<InputIt>::value, int> = 0>
+  void insert(iterator it, InputIt first, InputIt last) {
+    using Category = typename std::iterator_traits<InputIt>::iterator_category;
+    if constexpr (std::is_base_of<std::forward_iterator_tag,
+                                  Category>::value) {
+      insert_n(it - begin(), first, std::distance(first, last));
+    } else {
+      Deque temp(alloc_);
+      for (; first != last; ++first) {
+        temp.emplace_back(*first);
+      }
+      insert_n(it - begin(), std::make_move_iterator(temp.begin()),
+               temp.sz_);
+    }
+  }
+
+  template <typename InputIt,
+            std::enable_if_t<!std::is_integral<InputIt>::value, int> = 0>
+  void append(InputIt first, InputIt last) {
+    using Category = typename std::iterator_traits<InputIt>::iterator_category;
+    if constexpr (std::is_base_of<std::forward_iterator_tag,
+                                  Category>::value) {
+      append_n(first, std::distance(first, last));
+    } else {
+      for (; first != last; ++first) {
+        emplace_back(*first);
+      }
+    }
+  }
+
+  template <typename InputIt,
+            std::enable_if_t<!std::is_integral<InputIt>::value, int> = 0>
+  void prepend(InputIt first, InputIt last) {
+    using Category = typename std::iterator_traits<InputIt>::iterator_category;
+    if constexpr (std::is_base_of<std::forward_iterator_tag,
+                                  Category>::value) {
+      prepend_n(first, std::distance(first, last));
+    } else {
+      Deque temp(alloc_);
+      temp.append(first, last);
+      prepend_n(std::make_move_iterator(temp.begin()), temp.sz_);
+    }
+  }
+
+  void erase(iterator first, iterator last) {
+    size_t index = first - begin();
+    size_t count = last - first;
+    if (count == 0) {
+      return;
+    }
+    if (index < sz_ - index - count) {
+      move_elements(0, count, index);
+      for (size_t i = 0; i < count; ++i) {
+        pop_front();
+      }
+    } else {
+      move_elements(index + count, index, sz_ - index - count);
+      for (size_t i = 0; i < count; ++i) {
+        pop_back();
+      }
+    }
+  }
+
+  void erase(iterator it) { erase(it, it + 1); }
+
+  // Walks the deque a block at a time; each element is the span of live
+  // elements stored contiguously in one block.
+  template <bool is_const>
+  class base_segment_iterator {
+   private:
+    typedef typename std::conditional<is_const, const T, T>::type Value;
+
+    T* const* row_ = nullptr;
+    size_t column_ = 0;
+    size_t left_ = 0;
+
+    size_t run() const { return std::min(left_, block_sz_ - column_); }
+
+   public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = std::span<Value>;
+    using difference_type = std::ptrdiff_t;
+    using pointer = void;
+    using reference = value_type;
+
+    base_segment_iterator() = default;
+
+    base_segment_iterator(T* const* row, size_t column, size_t left)
+        : row_(row), column_(column), left_(left) {}
+
+    value_type operator*() const { return value_type(*row_ + column_, run()); }
+
+    base_segment_iterator& operator++() {
+      left_ -= run();
+      ++row_;
+      column_ = 0;
+      return *this;
     }
-    pop_back();
+
+    base_segment_iterator operator++(int) {
+      base_segment_iterator temp = *this;
+      ++*this;
+      return temp;
+    }
+
+    bool operator==(const base_segment_iterator& other) const {
+      return left_ == other.left_;
+    }
+  };
+
+  template <bool is_const>
+  class base_segment_range {
+   private:
+    base_segment_iterator<is_const> first_;
+
+   public:
+    explicit base_segment_range(base_segment_iterator<is_const> first)
+        : first_(first) {}
+
+    base_segment_iterator<is_const> begin() const { return first_; }
+
+    base_segment_iterator<is_const> end() const { return {}; }
+  };
+
+  typedef base_segment_range<false> segment_range;
+  typedef base_segment_range<true> const_segment_range;
+
+  segment_range segments() {
+    return segment_range({outer_array_ + begin_.row,
+                          static_cast<size_t>(begin_.column), sz_});
+  }
+
+  const_segment_range segments() const {
+    return const_segment_range({outer_array_ + begin_.row,
+                                static_cast<size_t>(begin_.column), sz_});
+  }
+};
+
+// Segmented algorithms: each runs a plain loop over one block's span at a
+// time, which the compiler can vectorize, instead of stepping a
+// Deque iterator across block boundaries.
+template <typename T, typename Alloc, typename BlockPolicy, typename Function>
+Function for_each(Deque<T, Alloc, BlockPolicy>& deque, Function func) {
+  for (std::span<T> segment : deque.segments()) {
+    for (T& value : segment) {
+      func(value);
+    }
+  }
+  return func;
+}
+
+template <typename T, typename Alloc, typename BlockPolicy, typename Function>
+Function for_each(const Deque<T, Alloc, BlockPolicy>& deque, Function func) {
+  for (std::span<const T> segment : deque.segments()) {
+    for (const T& value : segment) {
+      func(value);
+    }
+  }
+  return func;
+}
+
+template <typename T, typename Alloc, typename BlockPolicy,
+          typename OutputIt>
+OutputIt copy(const Deque<T, Alloc, BlockPolicy>& deque, OutputIt out) {
+  for (std::span<const T> segment : deque.segments()) {
+    out = std::copy(segment.begin(), segment.end(), out);
+  }
+  return out;
+}
+
+template <typename T, typename Alloc, typename BlockPolicy>
+void fill(Deque<T, Alloc, BlockPolicy>& deque, const T& value) {
+  for (std::span<T> segment : deque.segments()) {
+    std::fill(segment.begin(), segment.end(), value);
+  }
+}
+
+template <typename T, typename Alloc, typename BlockPolicy, typename U>
+typename Deque<T, Alloc, BlockPolicy>::iterator find(
+    Deque<T, Alloc, BlockPolicy>& deque, const U& value) {
+  size_t index = 0;
+  for (std::span<T> segment : deque.segments()) {
+    auto it = std::find(segment.begin(), segment.end(), value);
+    if (it != segment.end()) {
+      return deque.begin() + (index + (it - segment.begin()));
+    }
+    index += segment.size();
+  }
+  return deque.end();
+}
+
+template <typename T, typename Alloc, typename BlockPolicy, typename U>
+typename Deque<T, Alloc, BlockPolicy>::const_iterator find(
+    const Deque<T, Alloc, BlockPolicy>& deque, const U& value) {
+  size_t index = 0;
+  for (std::span<const T> segment : deque.segments()) {
+    auto it = std::find(segment.begin(), segment.end(), value);
+    if (it != segment.end()) {
+      return deque.begin() + (index + (it - segment.begin()));
+    }
+    index += segment.size();
+  }
+  return deque.end();
+}
+
+template <typename T, typename Alloc, typename BlockPolicy, typename Init,
+          typename BinaryOp = std::plus<>>
+Init accumulate(const Deque<T, Alloc, BlockPolicy>& deque, Init init,
+                BinaryOp op = BinaryOp()) {
+  for (std::span<const T> segment : deque.segments()) {
+    init = std::accumulate(segment.begin(), segment.end(), std::move(init), op);
   }
-};
\ No newline at end of file
+  return init;
+}
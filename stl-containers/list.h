@@ -1,18 +1,47 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cstddef>
 #include <cstdlib>
 #include <iostream>
 #include <iterator>
 #include <memory>
+#include <new>
 #include <type_traits>
 
+// Links of a list node. Copying an object that owns a hook must not copy
+// its place in a list, so a copied hook starts unlinked and assigning to a
+// hook leaves its links untouched.
+struct ListHook {
+  ListHook* prev = nullptr;
+  ListHook* next = nullptr;
+
+  ListHook() = default;
+
+  ListHook(ListHook* prev, ListHook* next) : prev(prev), next(next) {}
+
+  ListHook(const ListHook&) {}
+
+  ListHook& operator=(const ListHook&) { return *this; }
+};
+
 template <typename T, typename Alloc = std::allocator<T>>
 class List {
  private:
-  struct BaseNode {
-    BaseNode* prev = nullptr;
-    BaseNode* next = nullptr;
+  using BaseNode = ListHook;
+
+  struct Node;
+
+  struct NodeChunk {
+    Node* nodes;
+    size_t capacity;
+    size_t alive;
   };
 
   struct Node : public BaseNode {
+    NodeChunk* chunk;
     T value;
     Node(const T& value) : value(value) {}
   };
@@ -23,9 +52,68 @@ class List {
   using NodeAlloc =
       typename std::allocator_traits<Alloc>::template rebind_alloc<Node>;
   using NodeTraits = typename std::allocator_traits<NodeAlloc>;
+  using ChunkAlloc =
+      typename std::allocator_traits<Alloc>::template rebind_alloc<NodeChunk>;
+  using ChunkTraits = typename std::allocator_traits<ChunkAlloc>;
+
+  static constexpr size_t chunk_bytes_ = 1 << 16;
+  static constexpr size_t max_chunk_nodes_ =
+      (sizeof(Node) < chunk_bytes_) ? chunk_bytes_ / sizeof(Node) : 1;
 
   [[no_unique_address]] NodeAlloc alloc_;
 
+  void release_chunk(NodeChunk* chunk) {
+    alloc_.deallocate(chunk->nodes, chunk->capacity);
+    ChunkAlloc chunk_alloc = alloc_;
+    ChunkTraits::deallocate(chunk_alloc, chunk, 1);
+  }
+
+  void deallocate_node(Node* node) {
+    if (node->chunk == nullptr) {
+      alloc_.deallocate(node, 1);
+    } else if (--node->chunk->alive == 0) {
+      release_chunk(node->chunk);
+    }
+  }
+
+  // Appends count nodes carved in address order out of chunks of up to
+  // max_chunk_nodes_ nodes; construct(T*) builds each value in place.
+  template <typename Construct>
+  void append_chunked(size_t count, Construct construct) {
+    while (count > 0) {
+      size_t chunk_sz = std::min(count, max_chunk_nodes_);
+      ChunkAlloc chunk_alloc = alloc_;
+      NodeChunk* chunk = ChunkTraits::allocate(chunk_alloc, 1);
+      try {
+        chunk->nodes = alloc_.allocate(chunk_sz);
+      } catch (...) {
+        ChunkTraits::deallocate(chunk_alloc, chunk, 1);
+        throw;
+      }
+      chunk->capacity = chunk_sz;
+      chunk->alive = 0;
+      for (size_t i = 0; i < chunk_sz; ++i) {
+        Node* cur = chunk->nodes + i;
+        try {
+          construct(&cur->value);
+        } catch (...) {
+          if (chunk->alive == 0) {
+            release_chunk(chunk);
+          }
+          throw;
+        }
+        cur->chunk = chunk;
+        ++chunk->alive;
+        cur->prev = fake_node_.prev;
+        cur->next = &fake_node_;
+        fake_node_.prev->next = cur;
+        fake_node_.prev = cur;
+        ++sz_;
+      }
+      count -= chunk_sz;
+    }
+  }
+
   template <bool is_const>
   class base_iterator {
    private:
@@ -90,26 +178,15 @@ class List {
   using reverse_iterator = std::reverse_iterator<iterator>;
   using const_reverse_iterator = std::reverse_iterator<const_iterator>;
 
-  List<T, Alloc>(const Alloc& alloc = Alloc()) : alloc_(alloc) {}
+  List(const Alloc& alloc = Alloc()) : alloc_(alloc) {}
 
-  List<T, Alloc>(size_t init_sz, const Alloc& alloc = Alloc()) : alloc_(alloc) {
-    if (init_sz == 0) {
-      return;
-    }
-    BaseNode* prev = &fake_node_;
+  List(size_t init_sz, const Alloc& alloc = Alloc()) : alloc_(alloc) {
     try {
-      for (size_t i = 0; i < init_sz; ++i) {
-        Node* cur = alloc_.allocate(1);
+      append_chunked(init_sz, [this](T* place) {
         if constexpr (std::is_default_constructible<T>::value) {
-          NodeTraits::construct(alloc_, &cur->value);
+          NodeTraits::construct(alloc_, place);
         }
-        prev->next = cur;
-        cur->prev = prev;
-        prev = cur;
-        ++sz_;
-        cur->next = &fake_node_;
-        fake_node_.prev = cur;
-      }
+      });
     } catch (...) {
       size_t temp_sz = sz_;
       for (size_t i = 0; i < temp_sz; ++i) {
@@ -120,22 +197,41 @@ class List {
     alloc_ = alloc;
   }
 
-  List<T, Alloc>(size_t init_sz, const T& value, const Alloc& alloc = Alloc())
+  List(size_t init_sz, const T& value, const Alloc& alloc = Alloc())
       : alloc_(alloc) {
-    if (init_sz == 0) {
-      return;
+    try {
+      append_chunked(init_sz, [this, &value](T* place) {
+        NodeTraits::construct(alloc_, place, value);
+      });
+    } catch (...) {
+      size_t temp_sz = sz_;
+      for (size_t i = 0; i < temp_sz; ++i) {
+        erase(begin());
+      }
+      throw;
     }
-    BaseNode* prev = &fake_node_;
+  }
+
+  template <typename InputIt,
+            std::enable_if_t<
+                std::is_base_of<std::input_iterator_tag,
+                                typename std::iterator_traits<
+                                    InputIt>::iterator_category>::value,
+                int> = 0>
+  List(InputIt first, InputIt last, const Alloc& alloc = Alloc())
+      : alloc_(alloc) {
     try {
-      for (size_t i = 0; i < init_sz; ++i) {
-        Node* cur = alloc_.allocate(1);
-        NodeTraits::construct(alloc_, &cur->value, value);
-        prev->next = cur;
-        cur->prev = prev;
-        prev = cur;
-        ++sz_;
-        cur->next = &fake_node_;
-        fake_node_.prev = cur;
+      if constexpr (std::is_base_of<std::forward_iterator_tag,
+                                    typename std::iterator_traits<
+                                        InputIt>::iterator_category>::value) {
+        append_chunked(std::distance(first, last), [this, &first](T* place) {
+          NodeTraits::construct(alloc_, place, *first);
+          ++first;
+        });
+      } else {
+        for (; first != last; ++first) {
+          push_back(*first);
+        }
       }
     } catch (...) {
       size_t temp_sz = sz_;
@@ -150,25 +246,17 @@ class List {
 
   size_t size() const { return sz_; }
 
-  List<T, Alloc>(const List<T, Alloc>& other)
+  List(const List<T, Alloc>& other)
       : alloc_(
             std::allocator_traits<Alloc>::select_on_container_copy_construction(
                 other.alloc_)) {
-    BaseNode* prev = &fake_node_;
-    const BaseNode* other_cur = &other.fake_node_;
+    const BaseNode* other_cur = other.fake_node_.next;
     try {
-      for (size_t i = 0; i < other.sz_; ++i) {
-        other_cur = other_cur->next;
-        Node* cur = alloc_.allocate(1);
-        NodeTraits::construct(alloc_, &cur->value,
+      append_chunked(other.sz_, [this, &other_cur](T* place) {
+        NodeTraits::construct(alloc_, place,
                               static_cast<const Node*>(other_cur)->value);
-        prev->next = cur;
-        cur->prev = prev;
-        prev = cur;
-        ++sz_;
-        cur->next = &fake_node_;
-        fake_node_.prev = cur;
-      }
+        other_cur = other_cur->next;
+      });
     } catch (...) {
       size_t temp_sz = sz_;
       for (size_t i = 0; i < temp_sz; ++i) {
@@ -207,17 +295,11 @@ class List {
         while (sz_ > other.sz_) {
           erase(--end());
         }
-        while (other_cur != &other.fake_node_) {
-          Node* new_node = alloc_.allocate(1);
-          NodeTraits::construct(alloc_, &new_node->value,
+        append_chunked(other.sz_ - sz_, [this, &other_cur](T* place) {
+          NodeTraits::construct(alloc_, place,
                                 static_cast<const Node*>(other_cur)->value);
-          new_node->prev = fake_node_.prev;
-          new_node->next = &fake_node_;
-          fake_node_.prev->next = new_node;
-          fake_node_.prev = new_node;
           other_cur = other_cur->next;
-          ++sz_;
-        }
+        });
       } catch (...) {
         size_t help = sz_;
         for (size_t i = temp_sz; i < help; ++i) {
@@ -231,7 +313,13 @@ class List {
 
   void insert(const_iterator iter, const T& value) {
     Node* new_node = alloc_.allocate(1);
-    NodeTraits::construct(alloc_, &new_node->value, value);
+    try {
+      NodeTraits::construct(alloc_, &new_node->value, value);
+    } catch (...) {
+      alloc_.deallocate(new_node, 1);
+      throw;
+    }
+    new_node->chunk = nullptr;
     Node* temp = iter.GetNode();
     new_node->prev = temp->prev;
     new_node->next = temp;
@@ -245,7 +333,7 @@ class List {
     temp->prev->next = temp->next;
     temp->next->prev = temp->prev;
     NodeTraits::destroy(alloc_, &(temp->value));
-    alloc_.deallocate(temp, 1);
+    deallocate_node(temp);
     --sz_;
   }
 
@@ -301,10 +389,241 @@ class List {
   }
 };
 
+template <typename T, ListHook T::*Hook>
+class IntrusiveList {
+ private:
+  ListHook fake_node_ = {&fake_node_, &fake_node_};
+  size_t sz_ = 0;
+
+  static_assert(std::is_standard_layout<T>::value,
+                "IntrusiveList finds the owner of a hook by its offset and "
+                "needs a standard-layout T");
+  static_assert(sizeof(Hook) == sizeof(std::ptrdiff_t),
+                "IntrusiveList expects a data member pointer to hold the "
+                "member's byte offset");
+
+  // Both the Itanium C++ ABI and MSVC represent a data member pointer as
+  // the byte offset of the member, so no object is needed to find it.
+  static T* GetOwner(ListHook* hook) {
+    std::ptrdiff_t offset = std::bit_cast<std::ptrdiff_t>(Hook);
+    return reinterpret_cast<T*>(reinterpret_cast<char*>(hook) - offset);
+  }
+
+  void link(ListHook* place, ListHook* hook) {
+    assert(hook->prev == nullptr && hook->next == nullptr &&
+           "object is already linked through this hook");
+    hook->prev = place->prev;
+    hook->next = place;
+    place->prev->next = hook;
+    place->prev = hook;
+    ++sz_;
+  }
+
+  void unlink(ListHook* hook) {
+    assert(hook != &fake_node_ && "erase of end()");
+    hook->prev->next = hook->next;
+    hook->next->prev = hook->prev;
+    hook->prev = nullptr;
+    hook->next = nullptr;
+    --sz_;
+  }
+
+  template <bool is_const>
+  class base_iterator {
+   private:
+    ListHook* node_;
+
+   public:
+    using iterator_category = std::bidirectional_iterator_tag;
+    using value_type = typename std::conditional<is_const, const T, T>::type;
+    using difference_type = std::ptrdiff_t;
+    using pointer = value_type*;
+    using reference = value_type&;
+
+    base_iterator(ListHook* new_node) : node_(new_node) {}
+
+    template <bool was_const, std::enable_if_t<is_const && !was_const, int> = 0>
+    base_iterator(const base_iterator<was_const>& other)
+        : node_(other.GetBaseNode()) {}
+
+    reference operator*() const { return *GetOwner(node_); }
+
+    pointer operator->() const { return GetOwner(node_); }
+
+    base_iterator& operator++() {
+      node_ = node_->next;
+      return *this;
+    }
+
+    base_iterator operator++(int) {
+      base_iterator temp = *this;
+      ++(*this);
+      return temp;
+    }
+
+    base_iterator& operator--() {
+      node_ = node_->prev;
+      return *this;
+    }
+
+    base_iterator operator--(int) {
+      base_iterator temp = *this;
+      --(*this);
+      return temp;
+    }
+
+    bool operator==(const base_iterator& other) const {
+      return node_ == other.node_;
+    }
+
+    bool operator!=(const base_iterator& other) const {
+      return node_ != other.node_;
+    }
+
+    ListHook* GetBaseNode() const { return node_; }
+  };
+
+ public:
+  using value_type = T;
+  using iterator = base_iterator<false>;
+  using const_iterator = base_iterator<true>;
+  using reverse_iterator = std::reverse_iterator<iterator>;
+  using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+  IntrusiveList() = default;
+
+  IntrusiveList(const IntrusiveList&) = delete;
+
+  IntrusiveList& operator=(const IntrusiveList&) = delete;
+
+  IntrusiveList(IntrusiveList&& other) noexcept { swap(other); }
+
+  IntrusiveList& operator=(IntrusiveList&& other) noexcept {
+    if (this != &other) {
+      clear();
+      swap(other);
+    }
+    return *this;
+  }
+
+  void swap(IntrusiveList& other) noexcept {
+    std::swap(fake_node_.prev, other.fake_node_.prev);
+    std::swap(fake_node_.next, other.fake_node_.next);
+    std::swap(sz_, other.sz_);
+    for (IntrusiveList* list : {this, &other}) {
+      if (list->sz_ == 0) {
+        list->fake_node_.prev = &list->fake_node_;
+        list->fake_node_.next = &list->fake_node_;
+      } else {
+        list->fake_node_.next->prev = &list->fake_node_;
+        list->fake_node_.prev->next = &list->fake_node_;
+      }
+    }
+  }
+
+  size_t size() const { return sz_; }
+
+  bool empty() const { return sz_ == 0; }
+
+  void insert(const_iterator iter, T& value) {
+    link(iter.GetBaseNode(), &(value.*Hook));
+  }
+
+  void erase(const_iterator iter) { unlink(iter.GetBaseNode()); }
+
+  void erase(T& value) { unlink(&(value.*Hook)); }
+
+  iterator iterator_to(T& value) { return iterator(&(value.*Hook)); }
+
+  const_iterator iterator_to(const T& value) const {
+    return const_iterator(const_cast<ListHook*>(&(value.*Hook)));
+  }
+
+  void clear() {
+    while (sz_ > 0) {
+      unlink(fake_node_.next);
+    }
+  }
+
+  iterator begin() { return iterator(fake_node_.next); }
+
+  const_iterator begin() const { return const_iterator(fake_node_.next); }
+
+  const_iterator cbegin() const { return const_iterator(fake_node_.next); }
+
+  iterator end() { return iterator(&fake_node_); }
+
+  const_iterator end() const {
+    return const_iterator(const_cast<ListHook*>(&fake_node_));
+  }
+
+  const_iterator cend() const {
+    return const_iterator(const_cast<ListHook*>(&fake_node_));
+  }
+
+  reverse_iterator rbegin() { return reverse_iterator(end()); }
+
+  const_reverse_iterator rbegin() const {
+    return const_reverse_iterator(end());
+  }
+
+  const_reverse_iterator crbegin() const {
+    return const_reverse_iterator(cend());
+  }
+
+  reverse_iterator rend() { return reverse_iterator(begin()); }
+
+  const_reverse_iterator rend() const {
+    return const_reverse_iterator(begin());
+  }
+
+  const_reverse_iterator crend() const {
+    return const_reverse_iterator(cbegin());
+  }
+
+  T& front() { return *begin(); }
+
+  T& back() { return *(--end()); }
+
+  void push_front(T& value) { insert(cbegin(), value); }
+
+  void push_back(T& value) { insert(cend(), value); }
+
+  void pop_back() { erase(--end()); }
+
+  void pop_front() { erase(cbegin()); }
+
+  ~IntrusiveList() { clear(); }
+};
+
+// Bump arena over an inline buffer. Freed blocks of up to max_class_size
+// bytes are kept on per-size-class free lists and handed out again; once
+// the buffer is exhausted small blocks are carved from heap overflow pages
+// and larger blocks go straight to operator new.
 template <size_t N>
 struct StackStorage {
+  struct FreeBlock {
+    FreeBlock* next;
+  };
+
+  struct OverflowPage {
+    OverflowPage* next;
+  };
+
+  static const size_t class_step = alignof(max_align_t);
+  static const size_t class_count = 32;
+  static const size_t max_class_size = class_step * class_count;
+  static const size_t page_header_size =
+      (sizeof(OverflowPage) + class_step - 1) / class_step * class_step;
+  static const size_t overflow_page_size =
+      std::max<size_t>(N, 4096) + page_header_size;
+
   alignas(max_align_t) char data[N];
   size_t offset = 0;
+  FreeBlock* free_lists[class_count] = {};
+  OverflowPage* overflow_pages = nullptr;
+  char* overflow_cur = nullptr;
+  size_t overflow_left = 0;
 
   StackStorage() = default;
 
@@ -312,17 +631,90 @@ struct StackStorage {
 
   StackStorage& operator=(const StackStorage&) = delete;
 
-  ~StackStorage() = default;
+  ~StackStorage() { release_overflow(); }
+
+  static size_t size_class(size_t size) {
+    return (std::max<size_t>(size, 1) - 1) / class_step;
+  }
+
+  static bool is_pooled(size_t size, size_t alignment) {
+    return size <= max_class_size && alignment <= class_step;
+  }
+
+  bool owns(const void* ptr) const {
+    return static_cast<const char*>(ptr) >= data &&
+           static_cast<const char*>(ptr) < data + N;
+  }
 
   void* allocate(size_t size, size_t alignment) {
-    size_t padding = (alignment - offset % alignment) % alignment;
-    size_t adjustedSize = padding + size;
-    void* result = data + offset + padding;
-    offset += adjustedSize;
+    if (alignment > class_step) {
+      return ::operator new(size, std::align_val_t(alignment));
+    }
+    size_t cls = size_class(size);
+    if (size <= max_class_size && free_lists[cls] != nullptr) {
+      FreeBlock* block = free_lists[cls];
+      free_lists[cls] = block->next;
+      return block;
+    }
+    size_t block_size = (cls + 1) * class_step;
+    if (N - offset >= block_size) {
+      void* result = data + offset;
+      offset += block_size;
+      return result;
+    }
+    if (size > max_class_size) {
+      return ::operator new(size, std::align_val_t(alignment));
+    }
+    return allocate_overflow(block_size);
+  }
+
+  // Large blocks carved from the buffer are only reclaimed by reset().
+  void deallocate(void* ptr, size_t size, size_t alignment) {
+    if (!is_pooled(size, alignment)) {
+      if (!owns(ptr)) {
+        ::operator delete(ptr, size, std::align_val_t(alignment));
+      }
+      return;
+    }
+    size_t cls = size_class(size);
+    FreeBlock* block = static_cast<FreeBlock*>(ptr);
+    block->next = free_lists[cls];
+    free_lists[cls] = block;
+  }
+
+  // Forgets every pooled block at once. Only valid when nothing allocated
+  // from the storage is still in use.
+  void reset() {
+    offset = 0;
+    std::fill(free_lists, free_lists + class_count, nullptr);
+    release_overflow();
+  }
+
+ private:
+  void* allocate_overflow(size_t block_size) {
+    if (overflow_left < block_size) {
+      char* page = static_cast<char*>(::operator new(overflow_page_size));
+      OverflowPage* header = reinterpret_cast<OverflowPage*>(page);
+      header->next = overflow_pages;
+      overflow_pages = header;
+      overflow_cur = page + page_header_size;
+      overflow_left = overflow_page_size - page_header_size;
+    }
+    void* result = overflow_cur;
+    overflow_cur += block_size;
+    overflow_left -= block_size;
     return result;
   }
 
-  void deallocate(void*, size_t) {}
+  void release_overflow() {
+    while (overflow_pages != nullptr) {
+      OverflowPage* next = overflow_pages->next;
+      ::operator delete(overflow_pages);
+      overflow_pages = next;
+    }
+    overflow_cur = nullptr;
+    overflow_left = 0;
+  }
 };
 
 template <typename T, size_t N>
@@ -354,7 +746,7 @@ class StackAllocator {
   }
 
   void deallocate(T* ptr, size_t n) {
-    storage_->deallocate(ptr, n * sizeof(T));
+    storage_->deallocate(ptr, n * sizeof(T), alignof(T));
   }
 
   template <typename U>
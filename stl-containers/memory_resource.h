@@ -0,0 +1,449 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <type_traits>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#endif
+
+class MemoryResource {
+ public:
+  void* allocate(size_t bytes, size_t alignment = alignof(max_align_t)) {
+    return do_allocate(bytes, alignment);
+  }
+
+  void deallocate(void* ptr, size_t bytes,
+                  size_t alignment = alignof(max_align_t)) {
+    do_deallocate(ptr, bytes, alignment);
+  }
+
+  bool is_equal(const MemoryResource& other) const noexcept {
+    return do_is_equal(other);
+  }
+
+  virtual ~MemoryResource() = default;
+
+ private:
+  virtual void* do_allocate(size_t bytes, size_t alignment) = 0;
+  virtual void do_deallocate(void* ptr, size_t bytes, size_t alignment) = 0;
+  virtual bool do_is_equal(const MemoryResource& other) const noexcept = 0;
+};
+
+inline bool operator==(const MemoryResource& first,
+                       const MemoryResource& second) {
+  return &first == &second || first.is_equal(second);
+}
+
+inline bool operator!=(const MemoryResource& first,
+                       const MemoryResource& second) {
+  return !(first == second);
+}
+
+class NewDeleteResource : public MemoryResource {
+ private:
+  void* do_allocate(size_t bytes, size_t alignment) override {
+    return ::operator new(bytes, std::align_val_t(alignment));
+  }
+
+  void do_deallocate(void* ptr, size_t bytes, size_t alignment) override {
+    ::operator delete(ptr, bytes, std::align_val_t(alignment));
+  }
+
+  bool do_is_equal(const MemoryResource& other) const noexcept override {
+    return this == &other;
+  }
+};
+
+inline MemoryResource* new_delete_resource() {
+  static NewDeleteResource resource;
+  return &resource;
+}
+
+inline std::atomic<MemoryResource*>& default_resource_slot() {
+  static std::atomic<MemoryResource*> slot{new_delete_resource()};
+  return slot;
+}
+
+inline MemoryResource* get_default_resource() {
+  return default_resource_slot().load(std::memory_order_acquire);
+}
+
+inline MemoryResource* set_default_resource(MemoryResource* resource) {
+  if (resource == nullptr) {
+    resource = new_delete_resource();
+  }
+  return default_resource_slot().exchange(resource, std::memory_order_acq_rel);
+}
+
+// Hands out memory by bumping a pointer through buffers taken from upstream
+// (each one twice the size of the previous); deallocate is a no-op and
+// everything is returned at once by release() or the destructor.
+class MonotonicBufferResource : public MemoryResource {
+ private:
+  struct Chunk {
+    Chunk* next;
+    size_t size;
+    size_t alignment;
+  };
+
+  static constexpr size_t start_buffer_sz_ = 1024;
+
+  MemoryResource* upstream_;
+  void* initial_buffer_ = nullptr;
+  size_t initial_sz_ = 0;
+  Chunk* chunks_ = nullptr;
+  char* cur_ = nullptr;
+  size_t left_ = 0;
+  size_t next_buffer_sz_ = start_buffer_sz_;
+
+  void grow(size_t bytes, size_t alignment) {
+    size_t chunk_alignment = std::max(alignment, alignof(Chunk));
+    size_t header_sz =
+        (sizeof(Chunk) + chunk_alignment - 1) / chunk_alignment *
+        chunk_alignment;
+    size_t buffer_sz = std::max(next_buffer_sz_, bytes);
+    char* raw = static_cast<char*>(
+        upstream_->allocate(header_sz + buffer_sz, chunk_alignment));
+    Chunk* chunk = reinterpret_cast<Chunk*>(raw);
+    chunk->next = chunks_;
+    chunk->size = header_sz + buffer_sz;
+    chunk->alignment = chunk_alignment;
+    chunks_ = chunk;
+    cur_ = raw + header_sz;
+    left_ = buffer_sz;
+    next_buffer_sz_ = 2 * buffer_sz;
+  }
+
+  void* do_allocate(size_t bytes, size_t alignment) override {
+    void* ptr = cur_;
+    if (cur_ == nullptr ||
+        std::align(alignment, bytes, ptr, left_) == nullptr) {
+      grow(bytes, alignment);
+      ptr = cur_;
+    }
+    cur_ = static_cast<char*>(ptr) + bytes;
+    left_ -= bytes;
+    return ptr;
+  }
+
+  void do_deallocate(void*, size_t, size_t) override {}
+
+  bool do_is_equal(const MemoryResource& other) const noexcept override {
+    return this == &other;
+  }
+
+ public:
+  explicit MonotonicBufferResource(
+      MemoryResource* upstream = get_default_resource())
+      : upstream_(upstream) {}
+
+  MonotonicBufferResource(size_t initial_size,
+                          MemoryResource* upstream = get_default_resource())
+      : upstream_(upstream),
+        next_buffer_sz_(std::max<size_t>(initial_size, 1)) {}
+
+  MonotonicBufferResource(void* buffer, size_t buffer_size,
+                          MemoryResource* upstream = get_default_resource())
+      : upstream_(upstream),
+        initial_buffer_(buffer),
+        initial_sz_(buffer_size),
+        cur_(static_cast<char*>(buffer)),
+        left_(buffer_size),
+        next_buffer_sz_(std::max(buffer_size, start_buffer_sz_)) {}
+
+  MonotonicBufferResource(const MonotonicBufferResource&) = delete;
+
+  MonotonicBufferResource& operator=(const MonotonicBufferResource&) = delete;
+
+  MemoryResource* upstream_resource() const { return upstream_; }
+
+  void release() {
+    while (chunks_ != nullptr) {
+      Chunk* next = chunks_->next;
+      upstream_->deallocate(chunks_, chunks_->size, chunks_->alignment);
+      chunks_ = next;
+    }
+    cur_ = static_cast<char*>(initial_buffer_);
+    left_ = initial_sz_;
+    next_buffer_sz_ = std::max(initial_sz_, start_buffer_sz_);
+  }
+
+  ~MonotonicBufferResource() override { release(); }
+};
+
+// Keeps one free list per power-of-two block size up to max_block_sz_;
+// blocks are carved from slabs taken from upstream and reused after
+// deallocate. Larger or over-aligned requests go straight to upstream.
+class UnsynchronizedPoolResource : public MemoryResource {
+ private:
+  struct FreeBlock {
+    FreeBlock* next;
+  };
+
+  struct Slab {
+    Slab* next;
+    size_t size;
+  };
+
+  static constexpr size_t min_block_shift_ = 3;
+  static constexpr size_t pool_count_ = 10;
+  static constexpr size_t max_block_sz_ = size_t(1)
+                                      << (min_block_shift_ + pool_count_ - 1);
+  static constexpr size_t blocks_per_slab_ = 32;
+  static constexpr size_t slab_header_sz_ =
+      (sizeof(Slab) + alignof(max_align_t) - 1) / alignof(max_align_t) *
+      alignof(max_align_t);
+
+  MemoryResource* upstream_;
+  FreeBlock* free_lists_[pool_count_] = {};
+  Slab* slabs_ = nullptr;
+
+  static size_t pool_index(size_t bytes) {
+    size_t index = 0;
+    while ((size_t(1) << (min_block_shift_ + index)) < bytes) {
+      ++index;
+    }
+    return index;
+  }
+
+  void refill(size_t index) {
+    size_t block_sz = size_t(1) << (min_block_shift_ + index);
+    size_t slab_sz = slab_header_sz_ + block_sz * blocks_per_slab_;
+    char* raw = static_cast<char*>(
+        upstream_->allocate(slab_sz, alignof(max_align_t)));
+    Slab* slab = reinterpret_cast<Slab*>(raw);
+    slab->next = slabs_;
+    slab->size = slab_sz;
+    slabs_ = slab;
+    for (size_t i = blocks_per_slab_; i > 0; --i) {
+      FreeBlock* block = reinterpret_cast<FreeBlock*>(
+          raw + slab_header_sz_ + (i - 1) * block_sz);
+      block->next = free_lists_[index];
+      free_lists_[index] = block;
+    }
+  }
+
+  void* do_allocate(size_t bytes, size_t alignment) override {
+    size_t need = std::max(bytes, alignment);
+    if (need > max_block_sz_ || alignment > alignof(max_align_t)) {
+      return upstream_->allocate(bytes, alignment);
+    }
+    size_t index = pool_index(need);
+    if (free_lists_[index] == nullptr) {
+      refill(index);
+    }
+    FreeBlock* block = free_lists_[index];
+    free_lists_[index] = block->next;
+    return block;
+  }
+
+  void do_deallocate(void* ptr, size_t bytes, size_t alignment) override {
+    size_t need = std::max(bytes, alignment);
+    if (need > max_block_sz_ || alignment > alignof(max_align_t)) {
+      upstream_->deallocate(ptr, bytes, alignment);
+      return;
+    }
+    size_t index = pool_index(need);
+    FreeBlock* block = static_cast<FreeBlock*>(ptr);
+    block->next = free_lists_[index];
+    free_lists_[index] = block;
+  }
+
+  bool do_is_equal(const MemoryResource& other) const noexcept override {
+    return this == &other;
+  }
+
+ public:
+  explicit UnsynchronizedPoolResource(
+      MemoryResource* upstream = get_default_resource())
+      : upstream_(upstream) {}
+
+  UnsynchronizedPoolResource(const UnsynchronizedPoolResource&) = delete;
+
+  UnsynchronizedPoolResource& operator=(const UnsynchronizedPoolResource&) =
+      delete;
+
+  MemoryResource* upstream_resource() const { return upstream_; }
+
+  void release() {
+    while (slabs_ != nullptr) {
+      Slab* next = slabs_->next;
+      upstream_->deallocate(slabs_, slabs_->size, alignof(max_align_t));
+      slabs_ = next;
+    }
+    std::fill(free_lists_, free_lists_ + pool_count_, nullptr);
+  }
+
+  ~UnsynchronizedPoolResource() override { release(); }
+};
+
+class SynchronizedPoolResource : public MemoryResource {
+ private:
+  UnsynchronizedPoolResource pool_;
+  std::mutex mutex_;
+
+  void* do_allocate(size_t bytes, size_t alignment) override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return pool_.allocate(bytes, alignment);
+  }
+
+  void do_deallocate(void* ptr, size_t bytes, size_t alignment) override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    pool_.deallocate(ptr, bytes, alignment);
+  }
+
+  bool do_is_equal(const MemoryResource& other) const noexcept override {
+    return this == &other;
+  }
+
+ public:
+  explicit SynchronizedPoolResource(
+      MemoryResource* upstream = get_default_resource())
+      : pool_(upstream) {}
+
+  MemoryResource* upstream_resource() const {
+    return pool_.upstream_resource();
+  }
+
+  void release() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    pool_.release();
+  }
+};
+
+#if defined(__unix__) || defined(__APPLE__)
+// Serves requests of at least threshold bytes from anonymous mappings that are
+// aligned to and rounded up to huge_page_size and advised for transparent huge
+// pages where the kernel supports it; smaller requests go to upstream. Meant
+// as the block source of very large containers, e.g. a Deque using
+// PolymorphicAllocator with DequeBlockBytes<HugePageResource::huge_page_size>.
+class HugePageResource : public MemoryResource {
+ public:
+  static constexpr size_t huge_page_size = size_t(1) << 21;
+
+ private:
+  MemoryResource* upstream_;
+  size_t threshold_;
+
+  static size_t mapping_size(size_t bytes) {
+    return (bytes + huge_page_size - 1) / huge_page_size * huge_page_size;
+  }
+
+  bool is_large(size_t bytes, size_t alignment) const {
+    return bytes >= threshold_ && alignment <= huge_page_size;
+  }
+
+  void* do_allocate(size_t bytes, size_t alignment) override {
+    if (!is_large(bytes, alignment)) {
+      return upstream_->allocate(bytes, alignment);
+    }
+    size_t len = mapping_size(bytes);
+    void* raw = mmap(nullptr, len + huge_page_size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED) {
+      throw std::bad_alloc();
+    }
+    char* begin = static_cast<char*>(raw);
+    char* aligned = reinterpret_cast<char*>(
+        (reinterpret_cast<uintptr_t>(begin) + huge_page_size - 1) &
+        ~(huge_page_size - 1));
+    if (aligned != begin) {
+      munmap(begin, aligned - begin);
+    }
+    size_t tail = begin + len + huge_page_size - (aligned + len);
+    if (tail != 0) {
+      munmap(aligned + len, tail);
+    }
+#ifdef MADV_HUGEPAGE
+    madvise(aligned, len, MADV_HUGEPAGE);
+#endif
+    return aligned;
+  }
+
+  void do_deallocate(void* ptr, size_t bytes, size_t alignment) override {
+    if (!is_large(bytes, alignment)) {
+      upstream_->deallocate(ptr, bytes, alignment);
+      return;
+    }
+    munmap(ptr, mapping_size(bytes));
+  }
+
+  bool do_is_equal(const MemoryResource& other) const noexcept override {
+    return this == &other;
+  }
+
+ public:
+  explicit HugePageResource(size_t threshold = huge_page_size,
+                            MemoryResource* upstream = get_default_resource())
+      : upstream_(upstream), threshold_(threshold) {}
+
+  HugePageResource(const HugePageResource&) = delete;
+
+  HugePageResource& operator=(const HugePageResource&) = delete;
+
+  MemoryResource* upstream_resource() const { return upstream_; }
+};
+#endif
+
+template <typename T>
+class PolymorphicAllocator {
+ private:
+  MemoryResource* resource_;
+
+ public:
+  using value_type = T;
+
+  PolymorphicAllocator() noexcept : resource_(get_default_resource()) {}
+
+  PolymorphicAllocator(MemoryResource* resource) noexcept
+      : resource_(resource) {}
+
+  template <typename U>
+  PolymorphicAllocator(const PolymorphicAllocator<U>& other) noexcept
+      : resource_(other.resource()) {}
+
+  T* allocate(size_t n) {
+    return static_cast<T*>(resource_->allocate(n * sizeof(T), alignof(T)));
+  }
+
+  void deallocate(T* ptr, size_t n) {
+    resource_->deallocate(ptr, n * sizeof(T), alignof(T));
+  }
+
+  template <typename U, typename... Args>
+  void construct(U* ptr, Args&&... args) {
+    if constexpr (std::uses_allocator<U, PolymorphicAllocator>::value &&
+                  std::is_constructible<U, Args...,
+                                        PolymorphicAllocator>::value) {
+      ::new (static_cast<void*>(ptr)) U(std::forward<Args>(args)..., *this);
+    } else {
+      ::new (static_cast<void*>(ptr)) U(std::forward<Args>(args)...);
+    }
+  }
+
+  PolymorphicAllocator select_on_container_copy_construction() const {
+    return PolymorphicAllocator();
+  }
+
+  MemoryResource* resource() const { return resource_; }
+};
+
+template <typename T, typename U>
+bool operator==(const PolymorphicAllocator<T>& first,
+                const PolymorphicAllocator<U>& second) {
+  return *first.resource() == *second.resource();
+}
+
+template <typename T, typename U>
+bool operator!=(const PolymorphicAllocator<T>& first,
+                const PolymorphicAllocator<U>& second) {
+  return !(first == second);
+}
@@ -0,0 +1,195 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+#include "list.h"
+
+// Vyukov's intrusive multi-producer single-consumer queue over List's node
+// layout: the next field of a ListHook is accessed through atomic_ref and a
+// value-less stub node is always left at the tail. Nodes released by the
+// consumer are recycled through a bounded lock-free pool so that
+// steady-state traffic does not reach the allocator.
+template <typename T, typename Alloc = std::allocator<T>>
+class MpscQueue {
+ private:
+  struct Node : public ListHook {
+    T value;
+  };
+
+  struct Slot {
+    std::atomic<size_t> sequence;
+    Node* node;
+  };
+
+  using NodeAlloc =
+      typename std::allocator_traits<Alloc>::template rebind_alloc<Node>;
+  using NodeTraits = typename std::allocator_traits<NodeAlloc>;
+  using SlotAlloc =
+      typename std::allocator_traits<Alloc>::template rebind_alloc<Slot>;
+  using SlotTraits = typename std::allocator_traits<SlotAlloc>;
+
+  static constexpr size_t cache_line_sz_ = 64;
+
+  alignas(cache_line_sz_) std::atomic<ListHook*> head_;
+  alignas(cache_line_sz_) ListHook* tail_;
+  alignas(cache_line_sz_) std::atomic<size_t> pool_push_ = 0;
+  alignas(cache_line_sz_) std::atomic<size_t> pool_pop_ = 0;
+  Slot* pool_ = nullptr;
+  size_t pool_mask_ = 0;
+  [[no_unique_address]] NodeAlloc alloc_;
+
+  static std::atomic_ref<ListHook*> GetNext(ListHook* node) {
+    return std::atomic_ref<ListHook*>(node->next);
+  }
+
+  bool pool_push(Node* node) {
+    size_t pos = pool_push_.load(std::memory_order_relaxed);
+    Slot* slot;
+    while (true) {
+      slot = &pool_[pos & pool_mask_];
+      size_t sequence = slot->sequence.load(std::memory_order_acquire);
+      std::ptrdiff_t diff = static_cast<std::ptrdiff_t>(sequence - pos);
+      if (diff == 0) {
+        if (pool_push_.compare_exchange_weak(pos, pos + 1,
+                                             std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = pool_push_.load(std::memory_order_relaxed);
+      }
+    }
+    slot->node = node;
+    slot->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  Node* pool_pop() {
+    size_t pos = pool_pop_.load(std::memory_order_relaxed);
+    Slot* slot;
+    while (true) {
+      slot = &pool_[pos & pool_mask_];
+      size_t sequence = slot->sequence.load(std::memory_order_acquire);
+      std::ptrdiff_t diff = static_cast<std::ptrdiff_t>(sequence - (pos + 1));
+      if (diff == 0) {
+        if (pool_pop_.compare_exchange_weak(pos, pos + 1,
+                                            std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return nullptr;
+      } else {
+        pos = pool_pop_.load(std::memory_order_relaxed);
+      }
+    }
+    Node* node = slot->node;
+    slot->sequence.store(pos + pool_mask_ + 1, std::memory_order_release);
+    return node;
+  }
+
+  Node* acquire_node() {
+    Node* node = pool_pop();
+    if (node == nullptr) {
+      node = alloc_.allocate(1);
+    }
+    return node;
+  }
+
+  void release_node(Node* node) {
+    if (!pool_push(node)) {
+      alloc_.deallocate(node, 1);
+    }
+  }
+
+  void link(Node* node) {
+    GetNext(node).store(nullptr, std::memory_order_relaxed);
+    ListHook* prev = head_.exchange(node, std::memory_order_acq_rel);
+    GetNext(prev).store(node, std::memory_order_release);
+  }
+
+ public:
+  using value_type = T;
+
+  explicit MpscQueue(size_t pool_capacity = 1024,
+                     const Alloc& alloc = Alloc())
+      : alloc_(alloc) {
+    size_t pool_sz = 1;
+    while (pool_sz < pool_capacity) {
+      pool_sz *= 2;
+    }
+    SlotAlloc slot_alloc = alloc_;
+    pool_ = SlotTraits::allocate(slot_alloc, pool_sz);
+    for (size_t i = 0; i < pool_sz; ++i) {
+      new (&pool_[i].sequence) std::atomic<size_t>(i);
+    }
+    pool_mask_ = pool_sz - 1;
+    Node* stub = alloc_.allocate(1);
+    stub->next = nullptr;
+    head_.store(stub, std::memory_order_relaxed);
+    tail_ = stub;
+  }
+
+  MpscQueue(const MpscQueue&) = delete;
+
+  MpscQueue& operator=(const MpscQueue&) = delete;
+
+  Alloc get_allocator() const { return alloc_; }
+
+  template <typename... Args>
+  void emplace_back(Args&&... args) {
+    Node* node = acquire_node();
+    try {
+      NodeTraits::construct(alloc_, &node->value, std::forward<Args>(args)...);
+    } catch (...) {
+      release_node(node);
+      throw;
+    }
+    link(node);
+  }
+
+  void push_back(const T& value) { emplace_back(value); }
+
+  void push_back(T&& value) { emplace_back(std::move(value)); }
+
+  // Consumer side only. Returns false when the queue is empty or the most
+  // recent producer has not finished linking its node yet.
+  bool try_pop_front(T& value) {
+    ListHook* tail = tail_;
+    ListHook* next = GetNext(tail).load(std::memory_order_acquire);
+    if (next == nullptr) {
+      return false;
+    }
+    Node* node = static_cast<Node*>(next);
+    value = std::move(node->value);
+    NodeTraits::destroy(alloc_, &node->value);
+    tail_ = next;
+    release_node(static_cast<Node*>(tail));
+    return true;
+  }
+
+  // Consumer side only.
+  bool empty() const {
+    return GetNext(tail_).load(std::memory_order_acquire) == nullptr;
+  }
+
+  ~MpscQueue() {
+    ListHook* cur = GetNext(tail_).load(std::memory_order_acquire);
+    while (cur != nullptr) {
+      ListHook* next = cur->next;
+      NodeTraits::destroy(alloc_, &static_cast<Node*>(cur)->value);
+      alloc_.deallocate(static_cast<Node*>(cur), 1);
+      cur = next;
+    }
+    alloc_.deallocate(static_cast<Node*>(tail_), 1);
+    for (Node* node = pool_pop(); node != nullptr; node = pool_pop()) {
+      alloc_.deallocate(node, 1);
+    }
+    SlotAlloc slot_alloc = alloc_;
+    SlotTraits::deallocate(slot_alloc, pool_, pool_mask_ + 1);
+  }
+};
@@ -0,0 +1,314 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <numeric>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "deque.h"
+#include "work_stealing_deque.h"
+
+// Parallel algorithms over Deque. Work is split along block boundaries: the
+// deque's contiguous block spans are grouped into chunks of similar size and
+// each chunk runs as one task on a WorkStealingPool, working on raw
+// pointers. The calling thread helps run tasks while it waits.
+template <typename T>
+class DequeChunks {
+ private:
+  static constexpr size_t min_chunk_sz_ = size_t(1) << 14;
+  static constexpr size_t chunks_per_worker_ = 4;
+
+  std::vector<std::span<T>> spans_;
+  std::vector<size_t> offsets_;
+  std::vector<size_t> bounds_;
+
+ public:
+  template <typename SegmentRange>
+  DequeChunks(SegmentRange segments, size_t size, size_t workers) {
+    offsets_.push_back(0);
+    for (std::span<T> segment : segments) {
+      spans_.push_back(segment);
+      offsets_.push_back(offsets_.back() + segment.size());
+    }
+    size_t count = std::max<size_t>(
+        1, std::min(workers * chunks_per_worker_, size / min_chunk_sz_));
+    bounds_.push_back(0);
+    for (size_t c = 1; c < count; ++c) {
+      size_t target = size / count * c;
+      size_t span = std::upper_bound(offsets_.begin(), offsets_.end(), target) -
+                    offsets_.begin() - 1;
+      if (span > bounds_.back()) {
+        bounds_.push_back(span);
+      }
+    }
+    if (spans_.size() > bounds_.back()) {
+      bounds_.push_back(spans_.size());
+    }
+  }
+
+  size_t size() const { return bounds_.size() - 1; }
+
+  size_t first_span(size_t chunk) const { return bounds_[chunk]; }
+
+  size_t last_span(size_t chunk) const { return bounds_[chunk + 1]; }
+
+  std::span<T> span(size_t index) const { return spans_[index]; }
+
+  // Index of the first element of spans_[index]; offset(spans) is the size.
+  size_t offset(size_t index) const { return offsets_[index]; }
+
+  // Index of the span holding element pos.
+  size_t find(size_t pos) const {
+    return std::upper_bound(offsets_.begin(), offsets_.end(), pos) -
+           offsets_.begin() - 1;
+  }
+
+  // Spawns func(chunk) for every chunk and waits for all of them.
+  template <typename Function>
+  void run(WorkStealingPool& pool, Function func) const {
+    TaskGroup group;
+    for (size_t c = 1; c < size(); ++c) {
+      pool.spawn(group, [&func, c] { func(c); });
+    }
+    if (size() > 0) {
+      try {
+        func(0);
+      } catch (...) {
+        pool.wait(group);
+        throw;
+      }
+    }
+    pool.wait(group);
+  }
+};
+
+// Writes op(in[i]) to out[i] for every element of in; out must have at least
+// in.size() elements and may be in itself.
+template <typename T, typename AllocIn, typename PolicyIn, typename U,
+          typename AllocOut, typename PolicyOut, typename UnaryOp>
+void parallel_transform(WorkStealingPool& pool,
+                        const Deque<T, AllocIn, PolicyIn>& in,
+                        Deque<U, AllocOut, PolicyOut>& out, UnaryOp op) {
+  if (out.size() < in.size()) {
+    throw std::out_of_range("");
+  }
+  DequeChunks<const T> from(in.segments(), in.size(), pool.size() + 1);
+  DequeChunks<U> to(out.segments(), out.size(), 1);
+  from.run(pool, [&](size_t chunk) {
+    size_t first = from.first_span(chunk);
+    size_t pos = from.offset(first);
+    size_t dst = to.find(pos);
+    size_t dst_column = pos - to.offset(dst);
+    for (size_t s = first; s < from.last_span(chunk); ++s) {
+      std::span<const T> src = from.span(s);
+      size_t column = 0;
+      while (column < src.size()) {
+        std::span<U> target = to.span(dst);
+        size_t run = std::min(src.size() - column, target.size() - dst_column);
+        std::transform(src.data() + column, src.data() + column + run,
+                       target.data() + dst_column, op);
+        column += run;
+        dst_column += run;
+        if (dst_column == target.size()) {
+          ++dst;
+          dst_column = 0;
+        }
+      }
+    }
+  });
+}
+
+// Folds the deque with op, which must be associative: every chunk is folded
+// from its first element and the chunk results are folded into init in
+// order.
+template <typename T, typename Alloc, typename BlockPolicy, typename Init,
+          typename BinaryOp = std::plus<>>
+Init parallel_reduce(WorkStealingPool& pool,
+                     const Deque<T, Alloc, BlockPolicy>& deque, Init init,
+                     BinaryOp op = BinaryOp()) {
+  DequeChunks<const T> chunks(deque.segments(), deque.size(),
+                              pool.size() + 1);
+  std::vector<std::optional<Init>> partial(chunks.size());
+  chunks.run(pool, [&](size_t chunk) {
+    size_t first = chunks.first_span(chunk);
+    std::span<const T> head = chunks.span(first);
+    Init value = std::accumulate(head.begin() + 1, head.end(),
+                                 static_cast<Init>(head[0]), op);
+    for (size_t s = first + 1; s < chunks.last_span(chunk); ++s) {
+      std::span<const T> segment = chunks.span(s);
+      value = std::accumulate(segment.begin(), segment.end(), std::move(value),
+                              op);
+    }
+    partial[chunk].emplace(std::move(value));
+  });
+  for (std::optional<Init>& value : partial) {
+    init = op(std::move(init), std::move(*value));
+  }
+  return init;
+}
+
+// Merge sort through a scratch buffer of deque.size() elements. Block
+// chunks are moved into the buffer and sorted there with sort_run, then
+// runs are merged pairwise, alternating between the buffer and the deque.
+// Every merge is split into pieces of similar size by binary search on the
+// merge path, so all workers stay busy up to the last round. Merging takes
+// ties from the left run, which keeps the sort stable if sort_run is.
+template <typename T, typename Alloc, typename BlockPolicy, typename Compare,
+          typename SortRun>
+void parallel_merge_sort(WorkStealingPool& pool,
+                         Deque<T, Alloc, BlockPolicy>& deque, Compare comp,
+                         SortRun sort_run) {
+  using BufferAlloc =
+      typename std::allocator_traits<Alloc>::template rebind_alloc<T>;
+  using BufferTraits = typename std::allocator_traits<BufferAlloc>;
+
+  size_t size = deque.size();
+  size_t workers = pool.size() + 1;
+  DequeChunks<T> chunks(deque.segments(), size, workers);
+  if (chunks.size() < 2) {
+    sort_run(deque.begin(), deque.end(), comp);
+    return;
+  }
+
+  struct Buffer {
+    BufferAlloc alloc;
+    T* data;
+    size_t size;
+    std::vector<char> built;
+    const DequeChunks<T>& chunks;
+
+    ~Buffer() {
+      for (size_t c = 0; c < chunks.size(); ++c) {
+        if (built[c]) {
+          std::destroy(data + chunks.offset(chunks.first_span(c)),
+                       data + chunks.offset(chunks.last_span(c)));
+        }
+      }
+      BufferTraits::deallocate(alloc, data, size);
+    }
+  };
+  BufferAlloc buffer_alloc = deque.get_allocator();
+  Buffer buffer{buffer_alloc, BufferTraits::allocate(buffer_alloc, size),
+                size, std::vector<char>(chunks.size(), 0), chunks};
+
+  std::vector<size_t> runs;
+  for (size_t c = 0; c <= chunks.size(); ++c) {
+    runs.push_back(chunks.offset(c < chunks.size() ? chunks.first_span(c)
+                                                   : chunks.last_span(c - 1)));
+  }
+  chunks.run(pool, [&](size_t chunk) {
+    T* out = buffer.data + runs[chunk];
+    T* start = out;
+    for (size_t s = chunks.first_span(chunk); s < chunks.last_span(chunk);
+         ++s) {
+      std::span<T> segment = chunks.span(s);
+      out = std::uninitialized_move(segment.begin(), segment.end(), out);
+    }
+    buffer.built[chunk] = 1;
+    sort_run(start, out, comp);
+  });
+
+  // Number of elements a stable merge of a and b takes from a among its
+  // first count outputs.
+  auto split = [&comp](auto a, size_t a_size, auto b, size_t b_size,
+                       size_t count) {
+    size_t low = count > b_size ? count - b_size : 0;
+    size_t high = std::min(count, a_size);
+    while (low < high) {
+      size_t mid = low + (high - low) / 2;
+      if (!comp(*(b + (count - mid - 1)), *(a + mid))) {
+        low = mid + 1;
+      } else {
+        high = mid;
+      }
+    }
+    return low;
+  };
+
+  // Splits are all found before any piece starts: merging moves elements
+  // out of src, so a search running next to it would see moved-from values.
+  auto merge_round = [&](auto src, auto dst) {
+    struct Piece {
+      size_t a_first, a_last, b_first, b_last, out;
+    };
+    std::vector<Piece> pieces;
+    std::vector<size_t> merged;
+    size_t piece_sz = std::max<size_t>(1, size / (workers * 4));
+    for (size_t r = 0; r + 1 < runs.size(); r += 2) {
+      merged.push_back(runs[r]);
+      size_t lo = runs[r];
+      size_t mid = runs[r + 1];
+      size_t hi = r + 2 < runs.size() ? runs[r + 2] : mid;
+      size_t i0 = 0;
+      for (size_t piece = lo; piece < hi; piece += piece_sz) {
+        size_t piece_end = std::min(hi, piece + piece_sz);
+        size_t i1 = split(src + lo, mid - lo, src + mid, hi - mid,
+                          piece_end - lo);
+        pieces.push_back({lo + i0, lo + i1, mid + (piece - lo - i0),
+                          mid + (piece_end - lo - i1), piece});
+        i0 = i1;
+      }
+    }
+    merged.push_back(size);
+    TaskGroup group;
+    for (const Piece& piece : pieces) {
+      pool.spawn(group, [=, &comp] {
+        std::merge(std::make_move_iterator(src + piece.a_first),
+                   std::make_move_iterator(src + piece.a_last),
+                   std::make_move_iterator(src + piece.b_first),
+                   std::make_move_iterator(src + piece.b_last),
+                   dst + piece.out, comp);
+      });
+    }
+    pool.wait(group);
+    runs = std::move(merged);
+  };
+
+  bool in_buffer = true;
+  while (runs.size() > 2) {
+    if (in_buffer) {
+      merge_round(buffer.data, deque.begin());
+    } else {
+      merge_round(deque.begin(), buffer.data);
+    }
+    in_buffer = !in_buffer;
+  }
+  if (in_buffer) {
+    chunks.run(pool, [&](size_t chunk) {
+      T* in = buffer.data + chunks.offset(chunks.first_span(chunk));
+      for (size_t s = chunks.first_span(chunk); s < chunks.last_span(chunk);
+           ++s) {
+        std::span<T> segment = chunks.span(s);
+        std::move(in, in + segment.size(), segment.begin());
+        in += segment.size();
+      }
+    });
+  }
+}
+
+template <typename T, typename Alloc, typename BlockPolicy,
+          typename Compare = std::less<>>
+void parallel_sort(WorkStealingPool& pool, Deque<T, Alloc, BlockPolicy>& deque,
+                   Compare comp = Compare()) {
+  parallel_merge_sort(pool, deque, comp, [](auto first, auto last, auto& cmp) {
+    std::sort(first, last, cmp);
+  });
+}
+
+template <typename T, typename Alloc, typename BlockPolicy,
+          typename Compare = std::less<>>
+void parallel_stable_sort(WorkStealingPool& pool,
+                          Deque<T, Alloc, BlockPolicy>& deque,
+                          Compare comp = Compare()) {
+  parallel_merge_sort(pool, deque, comp, [](auto first, auto last, auto& cmp) {
+    std::stable_sort(first, last, cmp);
+  });
+}
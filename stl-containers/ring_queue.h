@@ -0,0 +1,375 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+// Bounded lock-free FIFO queues with a fixed power-of-two capacity. Both
+// offer the push_back/pop_front/size subset of Deque, so a pipeline stage
+// can switch between them and a locked Deque: push_back spins while the
+// queue is full and pop_front spins while it is empty. The try_* calls
+// never wait, and the *_n variants move a batch with one index update.
+
+// Single producer, single consumer. Each side keeps a cached copy of the
+// other side's index and only reloads it when the cache says the queue is
+// full (or empty), so in steady state the two threads do not share cache
+// lines.
+template <typename T, typename Alloc = std::allocator<T>>
+class SpscRing {
+ private:
+  using AllocTraits = std::allocator_traits<Alloc>;
+
+  static constexpr size_t cache_line_sz_ = 64;
+
+  alignas(cache_line_sz_) std::atomic<size_t> head_ = 0;
+  size_t tail_cache_ = 0;
+  alignas(cache_line_sz_) std::atomic<size_t> tail_ = 0;
+  size_t head_cache_ = 0;
+  alignas(cache_line_sz_) T* slots_ = nullptr;
+  size_t mask_ = 0;
+  [[no_unique_address]] Alloc alloc_;
+
+  // Producer side: free slots, reloading head_ only when needed.
+  size_t free_slots(size_t tail, size_t want) {
+    size_t free = mask_ + 1 - (tail - head_cache_);
+    if (free < want) {
+      head_cache_ = head_.load(std::memory_order_acquire);
+      free = mask_ + 1 - (tail - head_cache_);
+    }
+    return free;
+  }
+
+  // Consumer side: filled slots, reloading tail_ only when needed.
+  size_t filled_slots(size_t head, size_t want) {
+    size_t filled = tail_cache_ - head;
+    if (filled < want) {
+      tail_cache_ = tail_.load(std::memory_order_acquire);
+      filled = tail_cache_ - head;
+    }
+    return filled;
+  }
+
+ public:
+  using value_type = T;
+
+  explicit SpscRing(size_t capacity, const Alloc& alloc = Alloc())
+      : alloc_(alloc) {
+    size_t ring_sz = 1;
+    while (ring_sz < capacity) {
+      ring_sz *= 2;
+    }
+    slots_ = AllocTraits::allocate(alloc_, ring_sz);
+    mask_ = ring_sz - 1;
+  }
+
+  SpscRing(const SpscRing&) = delete;
+
+  SpscRing& operator=(const SpscRing&) = delete;
+
+  Alloc get_allocator() const { return alloc_; }
+
+  size_t capacity() const { return mask_ + 1; }
+
+  // Approximate while both sides are running.
+  size_t size() const {
+    size_t tail = tail_.load(std::memory_order_acquire);
+    size_t head = head_.load(std::memory_order_acquire);
+    return tail - head;
+  }
+
+  bool empty() const { return size() == 0; }
+
+  // Producer side only.
+  template <typename... Args>
+  bool try_emplace_back(Args&&... args) {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    if (free_slots(tail, 1) == 0) {
+      return false;
+    }
+    AllocTraits::construct(alloc_, slots_ + (tail & mask_),
+                           std::forward<Args>(args)...);
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool try_push_back(const T& value) { return try_emplace_back(value); }
+
+  bool try_push_back(T&& value) { return try_emplace_back(std::move(value)); }
+
+  void push_back(const T& value) {
+    while (!try_emplace_back(value)) {
+      std::this_thread::yield();
+    }
+  }
+
+  void push_back(T&& value) {
+    while (!try_emplace_back(std::move(value))) {
+      std::this_thread::yield();
+    }
+  }
+
+  // Producer side only. Copies up to count values from first and returns
+  // how many were pushed.
+  template <typename InputIt>
+  size_t try_push_n(InputIt first, size_t count) {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    size_t pushed = std::min(count, free_slots(tail, count));
+    for (size_t i = 0; i < pushed; ++i, ++first) {
+      AllocTraits::construct(alloc_, slots_ + ((tail + i) & mask_), *first);
+    }
+    tail_.store(tail + pushed, std::memory_order_release);
+    return pushed;
+  }
+
+  // Consumer side only.
+  bool try_pop_front(T& value) {
+    size_t head = head_.load(std::memory_order_relaxed);
+    if (filled_slots(head, 1) == 0) {
+      return false;
+    }
+    T* slot = slots_ + (head & mask_);
+    value = std::move(*slot);
+    AllocTraits::destroy(alloc_, slot);
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  T pop_front() {
+    size_t head = head_.load(std::memory_order_relaxed);
+    while (filled_slots(head, 1) == 0) {
+      std::this_thread::yield();
+    }
+    T* slot = slots_ + (head & mask_);
+    T value = std::move(*slot);
+    AllocTraits::destroy(alloc_, slot);
+    head_.store(head + 1, std::memory_order_release);
+    return value;
+  }
+
+  // Consumer side only. Moves up to count values to out and returns how
+  // many were popped.
+  template <typename OutputIt>
+  size_t try_pop_n(OutputIt out, size_t count) {
+    size_t head = head_.load(std::memory_order_relaxed);
+    size_t popped = std::min(count, filled_slots(head, count));
+    for (size_t i = 0; i < popped; ++i, ++out) {
+      T* slot = slots_ + ((head + i) & mask_);
+      *out = std::move(*slot);
+      AllocTraits::destroy(alloc_, slot);
+    }
+    head_.store(head + popped, std::memory_order_release);
+    return popped;
+  }
+
+  ~SpscRing() {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    for (size_t i = head_.load(std::memory_order_relaxed); i != tail; ++i) {
+      AllocTraits::destroy(alloc_, slots_ + (i & mask_));
+    }
+    AllocTraits::deallocate(alloc_, slots_, mask_ + 1);
+  }
+};
+
+// Vyukov's bounded multi-producer multi-consumer queue: every cell carries
+// a sequence number telling whether it is ready for the producer or the
+// consumer of a given lap, so producers and consumers only contend on
+// their own index. A batch claims a run of consecutive ready cells with a
+// single CAS.
+template <typename T, typename Alloc = std::allocator<T>>
+class MpmcRing {
+ private:
+  struct Cell {
+    std::atomic<size_t> sequence;
+    alignas(T) unsigned char storage[sizeof(T)];
+
+    T* value() { return std::launder(reinterpret_cast<T*>(storage)); }
+  };
+
+  using AllocTraits = std::allocator_traits<Alloc>;
+  using CellAlloc = typename AllocTraits::template rebind_alloc<Cell>;
+  using CellTraits = std::allocator_traits<CellAlloc>;
+
+  static constexpr size_t cache_line_sz_ = 64;
+
+  alignas(cache_line_sz_) std::atomic<size_t> enqueue_pos_ = 0;
+  alignas(cache_line_sz_) std::atomic<size_t> dequeue_pos_ = 0;
+  alignas(cache_line_sz_) Cell* cells_ = nullptr;
+  size_t mask_ = 0;
+  [[no_unique_address]] Alloc alloc_;
+
+  // Claims up to want consecutive cells whose sequence equals their
+  // position plus lag, advancing index past them. Returns the first claimed
+  // position and stores the number of cells in claimed.
+  size_t claim(std::atomic<size_t>& index, size_t lag, size_t want,
+               size_t& claimed) {
+    size_t pos = index.load(std::memory_order_relaxed);
+    while (true) {
+      size_t ready = 0;
+      while (ready < want) {
+        size_t sequence = cells_[(pos + ready) & mask_].sequence.load(
+            std::memory_order_acquire);
+        if (sequence != pos + ready + lag) {
+          break;
+        }
+        ++ready;
+      }
+      if (ready == 0) {
+        size_t sequence =
+            cells_[pos & mask_].sequence.load(std::memory_order_acquire);
+        std::ptrdiff_t diff =
+            static_cast<std::ptrdiff_t>(sequence - (pos + lag));
+        if (diff < 0) {
+          claimed = 0;
+          return pos;
+        }
+        pos = index.load(std::memory_order_relaxed);
+        continue;
+      }
+      if (index.compare_exchange_weak(pos, pos + ready,
+                                     std::memory_order_relaxed)) {
+        claimed = ready;
+        return pos;
+      }
+    }
+  }
+
+  template <typename... Args>
+  void fill(size_t pos, Args&&... args) {
+    Cell& cell = cells_[pos & mask_];
+    CellAlloc cell_alloc = alloc_;
+    CellTraits::construct(cell_alloc, cell.value(),
+                          std::forward<Args>(args)...);
+    cell.sequence.store(pos + 1, std::memory_order_release);
+  }
+
+  template <typename Out>
+  void drain(size_t pos, Out&& out) {
+    Cell& cell = cells_[pos & mask_];
+    CellAlloc cell_alloc = alloc_;
+    out = std::move(*cell.value());
+    CellTraits::destroy(cell_alloc, cell.value());
+    cell.sequence.store(pos + mask_ + 1, std::memory_order_release);
+  }
+
+ public:
+  using value_type = T;
+
+  explicit MpmcRing(size_t capacity, const Alloc& alloc = Alloc())
+      : alloc_(alloc) {
+    size_t ring_sz = 2;
+    while (ring_sz < capacity) {
+      ring_sz *= 2;
+    }
+    CellAlloc cell_alloc = alloc_;
+    cells_ = CellTraits::allocate(cell_alloc, ring_sz);
+    for (size_t i = 0; i < ring_sz; ++i) {
+      new (&cells_[i].sequence) std::atomic<size_t>(i);
+    }
+    mask_ = ring_sz - 1;
+  }
+
+  MpmcRing(const MpmcRing&) = delete;
+
+  MpmcRing& operator=(const MpmcRing&) = delete;
+
+  Alloc get_allocator() const { return alloc_; }
+
+  size_t capacity() const { return mask_ + 1; }
+
+  // Number of claimed but not yet dequeued positions; approximate while
+  // other threads are running.
+  size_t size() const {
+    size_t tail = enqueue_pos_.load(std::memory_order_acquire);
+    size_t head = dequeue_pos_.load(std::memory_order_acquire);
+    return tail > head ? tail - head : 0;
+  }
+
+  bool empty() const { return size() == 0; }
+
+  template <typename... Args>
+  bool try_emplace_back(Args&&... args) {
+    size_t claimed;
+    size_t pos = claim(enqueue_pos_, 0, 1, claimed);
+    if (claimed == 0) {
+      return false;
+    }
+    fill(pos, std::forward<Args>(args)...);
+    return true;
+  }
+
+  bool try_push_back(const T& value) { return try_emplace_back(value); }
+
+  bool try_push_back(T&& value) { return try_emplace_back(std::move(value)); }
+
+  void push_back(const T& value) {
+    while (!try_emplace_back(value)) {
+      std::this_thread::yield();
+    }
+  }
+
+  void push_back(T&& value) {
+    while (!try_emplace_back(std::move(value))) {
+      std::this_thread::yield();
+    }
+  }
+
+  template <typename InputIt>
+  size_t try_push_n(InputIt first, size_t count) {
+    size_t claimed = 0;
+    size_t pos = count == 0 ? 0 : claim(enqueue_pos_, 0, count, claimed);
+    for (size_t i = 0; i < claimed; ++i, ++first) {
+      fill(pos + i, *first);
+    }
+    return claimed;
+  }
+
+  bool try_pop_front(T& value) {
+    size_t claimed;
+    size_t pos = claim(dequeue_pos_, 1, 1, claimed);
+    if (claimed == 0) {
+      return false;
+    }
+    drain(pos, value);
+    return true;
+  }
+
+  T pop_front() {
+    size_t claimed;
+    size_t pos = claim(dequeue_pos_, 1, 1, claimed);
+    while (claimed == 0) {
+      std::this_thread::yield();
+      pos = claim(dequeue_pos_, 1, 1, claimed);
+    }
+    Cell& cell = cells_[pos & mask_];
+    CellAlloc cell_alloc = alloc_;
+    T value = std::move(*cell.value());
+    CellTraits::destroy(cell_alloc, cell.value());
+    cell.sequence.store(pos + mask_ + 1, std::memory_order_release);
+    return value;
+  }
+
+  template <typename OutputIt>
+  size_t try_pop_n(OutputIt out, size_t count) {
+    size_t claimed = 0;
+    size_t pos = count == 0 ? 0 : claim(dequeue_pos_, 1, count, claimed);
+    for (size_t i = 0; i < claimed; ++i, ++out) {
+      drain(pos + i, *out);
+    }
+    return claimed;
+  }
+
+  ~MpmcRing() {
+    size_t tail = enqueue_pos_.load(std::memory_order_relaxed);
+    CellAlloc cell_alloc = alloc_;
+    for (size_t i = dequeue_pos_.load(std::memory_order_relaxed); i != tail;
+         ++i) {
+      CellTraits::destroy(cell_alloc, cells_[i & mask_].value());
+    }
+    CellTraits::deallocate(cell_alloc, cells_, mask_ + 1);
+  }
+};
@@ -0,0 +1,506 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+// Ordered map on a skip list. Every node keeps its value and its whole
+// tower of next pointers in a single allocation. emplace/insert/find and
+// the bound queries may run concurrently with each other: insertion links
+// level 0 first and then the upper levels with CAS. erase, clear, copy and
+// assignment need exclusive access.
+template <typename Key, typename Value, typename Compare = std::less<Key>,
+          typename Alloc = std::allocator<std::pair<const Key, Value>>>
+class SkipList {
+ private:
+  using NodeType = std::pair<const Key, Value>;
+
+  struct Node {
+    NodeType value;
+    size_t height;
+  };
+
+  using Link = std::atomic<Node*>;
+  using NodeAlloc =
+      typename std::allocator_traits<Alloc>::template rebind_alloc<Node>;
+  using NodeTraits = typename std::allocator_traits<NodeAlloc>;
+
+  static constexpr size_t max_height_ = 32;
+  static constexpr size_t tower_offset_ =
+      (sizeof(Node) + alignof(Link) - 1) / alignof(Link) * alignof(Link);
+
+  [[no_unique_address]] Compare comp_;
+  [[no_unique_address]] NodeAlloc alloc_;
+  Node* head_ = nullptr;
+  std::atomic<size_t> height_ = 1;
+  std::atomic<size_t> sz_ = 0;
+
+  static Link* GetTower(Node* node) {
+    return reinterpret_cast<Link*>(reinterpret_cast<char*>(node) +
+                                   tower_offset_);
+  }
+
+  static Node* GetNext(Node* node, size_t level) {
+    return GetTower(node)[level].load(std::memory_order_acquire);
+  }
+
+  static size_t node_units(size_t height) {
+    return (tower_offset_ + height * sizeof(Link) + sizeof(Node) - 1) /
+           sizeof(Node);
+  }
+
+  static size_t random_height() {
+    thread_local uint64_t state =
+        0x9e3779b97f4a7c15ull ^ reinterpret_cast<uintptr_t>(&state);
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    uint64_t bits = state;
+    size_t height = 1;
+    while (height < max_height_ && (bits & 3) == 0) {
+      ++height;
+      bits >>= 2;
+    }
+    return height;
+  }
+
+  Node* allocate_node(size_t height) {
+    Node* node = alloc_.allocate(node_units(height));
+    node->height = height;
+    Link* tower = GetTower(node);
+    for (size_t i = 0; i < height; ++i) {
+      new (tower + i) Link(nullptr);
+    }
+    return node;
+  }
+
+  void deallocate_node(Node* node) {
+    alloc_.deallocate(node, node_units(node->height));
+  }
+
+  void destroy_node(Node* node) {
+    NodeTraits::destroy(alloc_, &node->value);
+    deallocate_node(node);
+  }
+
+  bool key_less(const Key& first, const Key& second) const {
+    return comp_(first, second);
+  }
+
+  // Fills preds/succs with the neighbours of key on every level, where
+  // succs[level] is the first node not less than key. Every level is
+  // searched, not just those below height_: an insert links its upper
+  // levels before raise_height publishes them. The head's links above the
+  // live height are mostly null, so this costs almost nothing.
+  void find_neighbours(const Key& key, Node** preds, Node** succs) const {
+    Node* pred = head_;
+    for (size_t level = max_height_; level-- > 0;) {
+      Node* cur = GetNext(pred, level);
+      while (cur != nullptr && key_less(cur->value.first, key)) {
+        pred = cur;
+        cur = GetNext(pred, level);
+      }
+      preds[level] = pred;
+      succs[level] = cur;
+    }
+  }
+
+  template <bool strict>
+  Node* find_bound(const Key& key) const {
+    Node* pred = head_;
+    Node* cur = nullptr;
+    for (size_t level = height_.load(std::memory_order_acquire);
+         level-- > 0;) {
+      cur = GetNext(pred, level);
+      while (cur != nullptr &&
+             (strict ? !key_less(key, cur->value.first)
+                     : key_less(cur->value.first, key))) {
+        pred = cur;
+        cur = GetNext(pred, level);
+      }
+    }
+    return cur;
+  }
+
+  void raise_height(size_t height) {
+    size_t cur = height_.load(std::memory_order_relaxed);
+    while (cur < height &&
+           !height_.compare_exchange_weak(cur, height,
+                                          std::memory_order_release,
+                                          std::memory_order_relaxed)) {
+    }
+  }
+
+  // Appends a node whose key is not less than any key already present;
+  // tails[level] is the last node on each level. Single-threaded only.
+  void append(Node* node, Node** tails) {
+    Link* tower = GetTower(node);
+    for (size_t level = 0; level < node->height; ++level) {
+      GetTower(tails[level])[level].store(node, std::memory_order_relaxed);
+      tower[level].store(nullptr, std::memory_order_relaxed);
+      tails[level] = node;
+    }
+    raise_height(node->height);
+    sz_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // Fills an empty list from [first, last), whose keys must be increasing.
+  // Single-threaded only.
+  template <typename InputIterator>
+  void append_sorted(InputIterator first, InputIterator last) {
+    Node* tails[max_height_];
+    std::fill(tails, tails + max_height_, head_);
+    for (; first != last; ++first) {
+      Node* node = allocate_node(random_height());
+      try {
+        NodeTraits::construct(alloc_, &node->value, *first);
+      } catch (...) {
+        deallocate_node(node);
+        throw;
+      }
+      append(node, tails);
+    }
+  }
+
+  // Exchanges the nodes (and the comparator that orders them), but not the
+  // allocators.
+  void swap_storage(SkipList& other) noexcept {
+    std::swap(comp_, other.comp_);
+    std::swap(head_, other.head_);
+    size_t height = height_.load(std::memory_order_relaxed);
+    height_.store(other.height_.load(std::memory_order_relaxed),
+                  std::memory_order_relaxed);
+    other.height_.store(height, std::memory_order_relaxed);
+    size_t sz = sz_.load(std::memory_order_relaxed);
+    sz_.store(other.sz_.load(std::memory_order_relaxed),
+              std::memory_order_relaxed);
+    other.sz_.store(sz, std::memory_order_relaxed);
+  }
+
+  template <bool is_const>
+  class base_iterator {
+   private:
+    Node* node_ = nullptr;
+
+   public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type =
+        typename std::conditional<is_const, const NodeType, NodeType>::type;
+    using difference_type = std::ptrdiff_t;
+    using pointer = value_type*;
+    using reference = value_type&;
+
+    base_iterator() = default;
+
+    base_iterator(Node* node) : node_(node) {}
+
+    template <bool was_const, std::enable_if_t<is_const && !was_const, int> = 0>
+    base_iterator(const base_iterator<was_const>& other)
+        : node_(other.GetNode()) {}
+
+    reference operator*() const { return node_->value; }
+
+    pointer operator->() const { return &node_->value; }
+
+    base_iterator& operator++() {
+      node_ = GetNext(node_, 0);
+      return *this;
+    }
+
+    base_iterator operator++(int) {
+      base_iterator temp = *this;
+      ++(*this);
+      return temp;
+    }
+
+    bool operator==(const base_iterator& other) const {
+      return node_ == other.node_;
+    }
+
+    bool operator!=(const base_iterator& other) const {
+      return node_ != other.node_;
+    }
+
+    Node* GetNode() const { return node_; }
+  };
+
+ public:
+  using key_type = Key;
+  using mapped_type = Value;
+  using value_type = NodeType;
+  using key_compare = Compare;
+  using allocator_type = Alloc;
+  using iterator = base_iterator<false>;
+  using const_iterator = base_iterator<true>;
+
+  explicit SkipList(const Compare& comp = Compare(),
+                    const Alloc& alloc = Alloc())
+      : comp_(comp), alloc_(alloc) {
+    head_ = allocate_node(max_height_);
+  }
+
+  explicit SkipList(const Alloc& alloc) : SkipList(Compare(), alloc) {}
+
+  SkipList(const SkipList& other, const Alloc& alloc)
+      : comp_(other.comp_), alloc_(alloc) {
+    head_ = allocate_node(max_height_);
+    try {
+      append_sorted(other.begin(), other.end());
+    } catch (...) {
+      clear();
+      deallocate_node(head_);
+      throw;
+    }
+  }
+
+  SkipList(const SkipList& other)
+      : SkipList(other, NodeTraits::select_on_container_copy_construction(
+                            other.alloc_)) {}
+
+  // Allocates a fresh head for other, so unlike the standard containers
+  // this may throw.
+  SkipList(SkipList&& other)
+      : comp_(std::move(other.comp_)), alloc_(other.alloc_) {
+    head_ = allocate_node(max_height_);
+    swap_storage(other);
+  }
+
+  void swap(SkipList& other) noexcept {
+    swap_storage(other);
+    if constexpr (NodeTraits::propagate_on_container_swap::value) {
+      std::swap(alloc_, other.alloc_);
+    }
+  }
+
+  SkipList& operator=(const SkipList& other) {
+    if (this != &other) {
+      SkipList temp(
+          other,
+          NodeTraits::propagate_on_container_copy_assignment::value
+              ? other.alloc_
+              : alloc_);
+      swap_storage(temp);
+      std::swap(alloc_, temp.alloc_);
+    }
+    return *this;
+  }
+
+  // Takes over other's nodes when the allocator propagates or compares
+  // equal; otherwise the elements are moved one by one into nodes from
+  // this list's allocator.
+  SkipList& operator=(SkipList&& other) noexcept(
+      NodeTraits::propagate_on_container_move_assignment::value ||
+      NodeTraits::is_always_equal::value) {
+    if (this == &other) {
+      return *this;
+    }
+    if constexpr (NodeTraits::propagate_on_container_move_assignment::value) {
+      clear();
+      swap_storage(other);
+      std::swap(alloc_, other.alloc_);
+    } else {
+      if (alloc_ == other.alloc_) {
+        clear();
+        swap_storage(other);
+      } else {
+        SkipList temp(other.comp_, alloc_);
+        temp.append_sorted(std::make_move_iterator(other.begin()),
+                           std::make_move_iterator(other.end()));
+        swap_storage(temp);
+      }
+    }
+    return *this;
+  }
+
+  Alloc get_allocator() const { return alloc_; }
+
+  size_t size() const { return sz_.load(std::memory_order_relaxed); }
+
+  bool empty() const { return size() == 0; }
+
+  iterator begin() { return iterator(GetNext(head_, 0)); }
+
+  const_iterator begin() const { return const_iterator(GetNext(head_, 0)); }
+
+  const_iterator cbegin() const { return const_iterator(GetNext(head_, 0)); }
+
+  iterator end() { return iterator(nullptr); }
+
+  const_iterator end() const { return const_iterator(nullptr); }
+
+  const_iterator cend() const { return const_iterator(nullptr); }
+
+  template <typename... Args>
+  std::pair<iterator, bool> emplace(Args&&... args) {
+    Node* node = allocate_node(random_height());
+    try {
+      NodeTraits::construct(alloc_, &node->value, std::forward<Args>(args)...);
+    } catch (...) {
+      deallocate_node(node);
+      throw;
+    }
+    const Key& key = node->value.first;
+    Link* tower = GetTower(node);
+    Node* preds[max_height_];
+    Node* succs[max_height_];
+    while (true) {
+      find_neighbours(key, preds, succs);
+      if (succs[0] != nullptr && !key_less(key, succs[0]->value.first)) {
+        destroy_node(node);
+        return {iterator(succs[0]), false};
+      }
+      for (size_t level = 0; level < node->height; ++level) {
+        tower[level].store(succs[level], std::memory_order_relaxed);
+      }
+      if (GetTower(preds[0])[0].compare_exchange_strong(
+              succs[0], node, std::memory_order_release,
+              std::memory_order_relaxed)) {
+        break;
+      }
+    }
+    for (size_t level = 1; level < node->height; ++level) {
+      while (!GetTower(preds[level])[level].compare_exchange_strong(
+          succs[level], node, std::memory_order_release,
+          std::memory_order_relaxed)) {
+        find_neighbours(key, preds, succs);
+        tower[level].store(succs[level], std::memory_order_relaxed);
+      }
+    }
+    raise_height(node->height);
+    sz_.fetch_add(1, std::memory_order_relaxed);
+    return {iterator(node), true};
+  }
+
+  std::pair<iterator, bool> insert(const NodeType& value) {
+    return emplace(value);
+  }
+
+  std::pair<iterator, bool> insert(NodeType&& value) {
+    return emplace(std::move(value));
+  }
+
+  template <typename InputIterator>
+  void insert(InputIterator first, InputIterator last) {
+    for (; first != last; ++first) {
+      emplace(*first);
+    }
+  }
+
+  iterator lower_bound(const Key& key) {
+    return iterator(find_bound<false>(key));
+  }
+
+  const_iterator lower_bound(const Key& key) const {
+    return const_iterator(find_bound<false>(key));
+  }
+
+  iterator upper_bound(const Key& key) {
+    return iterator(find_bound<true>(key));
+  }
+
+  const_iterator upper_bound(const Key& key) const {
+    return const_iterator(find_bound<true>(key));
+  }
+
+  std::pair<iterator, iterator> equal_range(const Key& key) {
+    return {lower_bound(key), upper_bound(key)};
+  }
+
+  std::pair<const_iterator, const_iterator> equal_range(const Key& key) const {
+    return {lower_bound(key), upper_bound(key)};
+  }
+
+  iterator find(const Key& key) {
+    Node* node = find_bound<false>(key);
+    if (node == nullptr || key_less(key, node->value.first)) {
+      return end();
+    }
+    return iterator(node);
+  }
+
+  const_iterator find(const Key& key) const {
+    Node* node = find_bound<false>(key);
+    if (node == nullptr || key_less(key, node->value.first)) {
+      return end();
+    }
+    return const_iterator(node);
+  }
+
+  bool contains(const Key& key) const { return find(key) != end(); }
+
+  Value& operator[](const Key& key) {
+    iterator it = find(key);
+    if (it == end()) {
+      return emplace(key, Value()).first->second;
+    }
+    return it->second;
+  }
+
+  Value& at(const Key& key) {
+    iterator it = find(key);
+    if (it == end()) {
+      throw std::out_of_range("");
+    }
+    return it->second;
+  }
+
+  const Value& at(const Key& key) const {
+    const_iterator it = find(key);
+    if (it == end()) {
+      throw std::out_of_range("");
+    }
+    return it->second;
+  }
+
+  bool erase(const Key& key) {
+    Node* preds[max_height_];
+    Node* succs[max_height_];
+    find_neighbours(key, preds, succs);
+    Node* node = succs[0];
+    if (node == nullptr || key_less(key, node->value.first)) {
+      return false;
+    }
+    for (size_t level = 0; level < node->height; ++level) {
+      if (succs[level] == node) {
+        GetTower(preds[level])[level].store(GetNext(node, level),
+                                            std::memory_order_release);
+      }
+    }
+    destroy_node(node);
+    sz_.fetch_sub(1, std::memory_order_relaxed);
+    return true;
+  }
+
+  void erase(const_iterator iter) { erase(iter->first); }
+
+  void clear() {
+    Node* cur = GetNext(head_, 0);
+    while (cur != nullptr) {
+      Node* next = GetNext(cur, 0);
+      destroy_node(cur);
+      cur = next;
+    }
+    Link* tower = GetTower(head_);
+    for (size_t level = 0; level < max_height_; ++level) {
+      tower[level].store(nullptr, std::memory_order_relaxed);
+    }
+    height_.store(1, std::memory_order_relaxed);
+    sz_.store(0, std::memory_order_relaxed);
+  }
+
+  ~SkipList() {
+    clear();
+    deallocate_node(head_);
+  }
+};
+
+template <typename Key, typename Value, typename Compare = std::less<Key>,
+          typename Alloc = std::allocator<std::pair<const Key, Value>>>
+using OrderedMap = SkipList<Key, Value, Compare, Alloc>;
@@ -0,0 +1,360 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <vector>
+
+#include "deque.h"
+
+// FIFO queue of trivially copyable values that may outgrow memory. Elements
+// live in fixed-size segments of a file, each mapped on demand with
+// MAP_SHARED; the map of segments is a Deque<T*> holding nullptr for
+// segments that are not mapped. Only the head segment (plus a prefetch
+// window after it) and the tail segment stay mapped. A segment that falls
+// between them is paged out and unmapped, so the kernel writes it back to
+// the file and can drop it from memory. When the head enters a new segment
+// the next prefetch_segments are mapped and advised MADV_WILLNEED, which
+// starts asynchronous readahead; consumed segments are unmapped and their
+// disk space is released.
+//
+// File layout (version 1): one page holding FileHeader, then segment k at
+// offset page + k * segment stride. head and tail are global element
+// indices, so a file reopened after a restart resumes where it stopped;
+// flush() makes the on-disk state durable.
+template <typename T>
+class SpillDeque {
+ private:
+  static_assert(std::is_trivially_copyable<T>::value,
+                "SpillDeque stores raw bytes and needs trivially copyable T");
+
+  struct FileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t elem_size;
+    uint64_t segment_elems;
+    uint64_t head;
+    uint64_t tail;
+  };
+
+  static constexpr char magic_[8] = {'S', 'P', 'I', 'L', 'L', 'D', 'Q', 0};
+  static constexpr uint32_t version_ = 1;
+
+  int fd_ = -1;
+  size_t page_sz_ = 0;
+  size_t segment_shift_ = 0;
+  size_t segment_mask_ = 0;
+  size_t segment_stride_ = 0;
+  size_t prefetch_ = 0;
+  FileHeader* header_ = nullptr;
+  uint64_t first_segment_ = 0;
+  uint64_t file_segments_ = 0;
+  mutable Deque<T*> map_;
+  mutable std::vector<uint64_t> strays_;
+
+  [[noreturn]] static void fail(const char* what) {
+    throw std::system_error(errno, std::generic_category(), what);
+  }
+
+  off_t segment_offset(uint64_t segment) const {
+    return page_sz_ + segment * segment_stride_;
+  }
+
+  T*& slot(uint64_t segment) const { return map_[segment - first_segment_]; }
+
+  T* map_segment(uint64_t segment) const {
+    T*& ptr = slot(segment);
+    if (ptr == nullptr) {
+      void* addr = mmap(nullptr, segment_stride_, PROT_READ | PROT_WRITE,
+                        MAP_SHARED, fd_, segment_offset(segment));
+      if (addr == MAP_FAILED) {
+        fail("SpillDeque: mmap");
+      }
+      ptr = static_cast<T*>(addr);
+    }
+    return ptr;
+  }
+
+  void unmap_segment(uint64_t segment, bool page_out) const {
+    T*& ptr = slot(segment);
+    if (ptr == nullptr) {
+      return;
+    }
+#ifdef MADV_PAGEOUT
+    if (page_out) {
+      madvise(ptr, segment_stride_, MADV_PAGEOUT);
+    }
+#endif
+    munmap(ptr, segment_stride_);
+    ptr = nullptr;
+  }
+
+  uint64_t head_segment() const { return header_->head >> segment_shift_; }
+
+  uint64_t tail_segment() const {
+    return (header_->tail - 1) >> segment_shift_;
+  }
+
+  bool is_hot(uint64_t segment) const {
+    uint64_t head = head_segment();
+    return (segment >= head && segment <= head + prefetch_) ||
+           segment == tail_segment();
+  }
+
+  // Unmaps the segment if it is neither in the head window nor the tail.
+  void cool(uint64_t segment) const {
+    if (!is_hot(segment)) {
+      unmap_segment(segment, true);
+    }
+  }
+
+  void cool_strays() const {
+    for (uint64_t segment : strays_) {
+      if (segment >= first_segment_ &&
+          segment < first_segment_ + map_.size()) {
+        cool(segment);
+      }
+    }
+    strays_.clear();
+  }
+
+  void warm_head() {
+    uint64_t last = std::min<uint64_t>(head_segment() + prefetch_,
+                                       tail_segment());
+    for (uint64_t segment = head_segment(); segment <= last; ++segment) {
+      if (slot(segment) == nullptr) {
+        madvise(map_segment(segment), segment_stride_, MADV_WILLNEED);
+      }
+    }
+  }
+
+  void release_segment_space(uint64_t segment) {
+#ifdef FALLOC_FL_PUNCH_HOLE
+    fallocate(fd_, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+              segment_offset(segment), segment_stride_);
+#else
+    (void)segment;
+#endif
+  }
+
+  // Called when the queue drains with the head on a segment boundary, so
+  // that nothing but consumed segments is mapped: drops them and truncates
+  // the file back to its header so that indices restart from zero. A queue
+  // that drains mid-segment keeps that segment mapped for the next push.
+  void reset() {
+    for (size_t i = 0; i < map_.size(); ++i) {
+      unmap_segment(first_segment_ + i, false);
+    }
+    map_.clear();
+    strays_.clear();
+    if (ftruncate(fd_, page_sz_) != 0) {
+      fail("SpillDeque: ftruncate");
+    }
+    file_segments_ = 0;
+    first_segment_ = 0;
+    header_->head = 0;
+    header_->tail = 0;
+  }
+
+  void open_file(const std::string& path, size_t segment_bytes) {
+    fd_ = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd_ < 0) {
+      fail("SpillDeque: open");
+    }
+    struct stat info;
+    if (fstat(fd_, &info) != 0) {
+      fail("SpillDeque: fstat");
+    }
+    bool fresh = static_cast<size_t>(info.st_size) < page_sz_;
+    if (fresh && ftruncate(fd_, page_sz_) != 0) {
+      fail("SpillDeque: ftruncate");
+    }
+    void* addr = mmap(nullptr, page_sz_, PROT_READ | PROT_WRITE, MAP_SHARED,
+                      fd_, 0);
+    if (addr == MAP_FAILED) {
+      fail("SpillDeque: mmap");
+    }
+    header_ = static_cast<FileHeader*>(addr);
+    if (fresh) {
+      size_t segment_elems = 1;
+      while (2 * segment_elems * sizeof(T) <= segment_bytes) {
+        segment_elems *= 2;
+      }
+      std::memcpy(header_->magic, magic_, sizeof(magic_));
+      header_->version = version_;
+      header_->elem_size = sizeof(T);
+      header_->segment_elems = segment_elems;
+      header_->head = 0;
+      header_->tail = 0;
+    } else if (std::memcmp(header_->magic, magic_, sizeof(magic_)) != 0 ||
+               header_->version != version_ ||
+               header_->elem_size != sizeof(T) ||
+               header_->segment_elems == 0 ||
+               (header_->segment_elems & (header_->segment_elems - 1)) != 0 ||
+               header_->head > header_->tail) {
+      throw std::runtime_error("SpillDeque: incompatible file " + path);
+    }
+    segment_shift_ = std::countr_zero(header_->segment_elems);
+    segment_mask_ = header_->segment_elems - 1;
+    size_t bytes = header_->segment_elems * sizeof(T);
+    segment_stride_ = (bytes + page_sz_ - 1) / page_sz_ * page_sz_;
+    file_segments_ = (info.st_size > static_cast<off_t>(page_sz_))
+                         ? (info.st_size - page_sz_) / segment_stride_
+                         : 0;
+  }
+
+  void close_file() {
+    for (size_t i = 0; i < map_.size(); ++i) {
+      unmap_segment(first_segment_ + i, false);
+    }
+    if (header_ != nullptr) {
+      munmap(header_, page_sz_);
+      header_ = nullptr;
+    }
+    if (fd_ >= 0) {
+      ::close(fd_);
+      fd_ = -1;
+    }
+  }
+
+ public:
+  using value_type = T;
+
+  // Opens path, creating it if needed. An existing file must have been
+  // written by a SpillDeque of the same format version and element size;
+  // its segment size wins over segment_bytes.
+  explicit SpillDeque(const std::string& path, size_t segment_bytes = 1 << 20,
+                      size_t prefetch_segments = 2)
+      : page_sz_(sysconf(_SC_PAGESIZE)), prefetch_(prefetch_segments) {
+    try {
+      open_file(path, segment_bytes);
+      if (header_->head == header_->tail) {
+        reset();
+        return;
+      }
+      first_segment_ = head_segment();
+      for (uint64_t s = first_segment_; s <= tail_segment(); ++s) {
+        map_.push_back(nullptr);
+      }
+      warm_head();
+      map_segment(tail_segment());
+    } catch (...) {
+      close_file();
+      throw;
+    }
+  }
+
+  SpillDeque(const SpillDeque&) = delete;
+
+  SpillDeque& operator=(const SpillDeque&) = delete;
+
+  size_t size() const { return header_->tail - header_->head; }
+
+  bool empty() const { return size() == 0; }
+
+  // Maps the element's segment if it is cold; such a segment is unmapped
+  // again the next time the head or tail crosses a segment boundary.
+  T& operator[](size_t index) {
+    uint64_t pos = header_->head + index;
+    uint64_t segment = pos >> segment_shift_;
+    T* base = slot(segment);
+    if (base == nullptr) {
+      base = map_segment(segment);
+      strays_.push_back(segment);
+    }
+    return base[pos & segment_mask_];
+  }
+
+  const T& operator[](size_t index) const {
+    return const_cast<SpillDeque&>(*this)[index];
+  }
+
+  T& at(size_t index) {
+    if (index >= size()) {
+      throw std::out_of_range("");
+    }
+    return (*this)[index];
+  }
+
+  const T& at(size_t index) const {
+    if (index >= size()) {
+      throw std::out_of_range("");
+    }
+    return (*this)[index];
+  }
+
+  void push_back(const T& value) {
+    uint64_t tail = header_->tail;
+    uint64_t segment = tail >> segment_shift_;
+    if ((tail & segment_mask_) == 0) {
+      if (segment >= file_segments_) {
+        if (ftruncate(fd_, segment_offset(segment + 1)) != 0) {
+          fail("SpillDeque: ftruncate");
+        }
+        file_segments_ = segment + 1;
+      }
+      if (map_.empty()) {
+        first_segment_ = segment;
+      }
+      map_.push_back(nullptr);
+      map_segment(segment);
+    }
+    // The element is written before tail covers it, so a file left by a
+    // crash never has a published slot that was not written.
+    slot(segment)[tail & segment_mask_] = value;
+    std::atomic_signal_fence(std::memory_order_release);
+    header_->tail = tail + 1;
+    if ((tail & segment_mask_) == 0) {
+      if (segment > first_segment_) {
+        cool(segment - 1);
+      }
+      cool_strays();
+    }
+  }
+
+  void pop_front() {
+    uint64_t head = ++header_->head;
+    if ((head & segment_mask_) == 0) {
+      if (head == header_->tail) {
+        reset();
+        return;
+      }
+      uint64_t old = first_segment_;
+      unmap_segment(old, false);
+      release_segment_space(old);
+      map_.pop_front();
+      ++first_segment_;
+      cool_strays();
+      warm_head();
+    }
+  }
+
+  // Writes every mapped segment and the header back to the file.
+  void flush() {
+    for (size_t i = 0; i < map_.size(); ++i) {
+      if (T* ptr = map_[i]) {
+        if (msync(ptr, segment_stride_, MS_SYNC) != 0) {
+          fail("SpillDeque: msync");
+        }
+      }
+    }
+    if (msync(header_, page_sz_, MS_SYNC) != 0) {
+      fail("SpillDeque: msync");
+    }
+  }
+
+  ~SpillDeque() { close_file(); }
+};
@@ -1,63 +1,654 @@
+#pragma once
+
 #include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
 #include <cstring>
 #include <iostream>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <random>
+#include <type_traits>
+#include <utility>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
-class String {
+// Substring search over raw character ranges; both functions return
+// text_sz when there is no match. Needles up to short_needle_sz_ go
+// through a filter that tests the first and last needle byte at every
+// candidate position (16 positions per step with SSE2, memchr otherwise)
+// and memcmp's only the survivors. Longer needles use the Two-Way
+// algorithm of Crochemore and Perrin, which is linear in the worst case,
+// with a bad-character table on the window's last byte that lets typical
+// text be skipped a needle length at a time; rfind runs it over the
+// reversed text and needle.
+class StringSearch {
  private:
-  size_t sz = 0;
-  char* arr = new char[5];
-  size_t cap = 4;
+  static constexpr size_t short_needle_sz_ = 32;
 
-  explicit String(size_t count)
-      : sz(count), arr(new char[count + 1]), cap(count) {
-    arr[count] = '\0';
+  // Finds the first match in text[0, text_sz) of needle[0, needle_sz),
+  // both read through at(i), returning text_sz when there is none.
+  template <typename TextAt, typename NeedleAt>
+  static size_t two_way(TextAt text, size_t text_sz, NeedleAt needle,
+                        size_t needle_sz) {
+    ptrdiff_t m = needle_sz;
+    ptrdiff_t n = text_sz;
+    ptrdiff_t period = 0;
+    ptrdiff_t ell = critical_factorization(needle, m, period);
+    bool periodic = true;
+    for (ptrdiff_t i = 0; i <= ell; ++i) {
+      if (needle(i) != needle(i + period)) {
+        periodic = false;
+        break;
+      }
+    }
+    ptrdiff_t shifts[256];
+    std::fill(shifts, shifts + 256, m);
+    for (ptrdiff_t i = 0; i < m; ++i) {
+      shifts[static_cast<unsigned char>(needle(i))] = m - 1 - i;
+    }
+    ptrdiff_t j = 0;
+    if (periodic) {
+      ptrdiff_t memory = -1;
+      while (j <= n - m) {
+        ptrdiff_t shift = shifts[static_cast<unsigned char>(text(j + m - 1))];
+        if (shift > 0) {
+          if (memory >= 0 && shift < period) {
+            shift = m - period;
+          }
+          memory = -1;
+          j += shift;
+          continue;
+        }
+        ptrdiff_t i = std::max(ell, memory) + 1;
+        while (i < m && needle(i) == text(i + j)) {
+          ++i;
+        }
+        if (i < m) {
+          j += i - ell;
+          memory = -1;
+          continue;
+        }
+        i = ell;
+        while (i > memory && needle(i) == text(i + j)) {
+          --i;
+        }
+        if (i <= memory) {
+          return j;
+        }
+        j += period;
+        memory = m - period - 1;
+      }
+      return text_sz;
+    }
+    period = std::max(ell + 1, m - ell - 1) + 1;
+    while (j <= n - m) {
+      ptrdiff_t shift = shifts[static_cast<unsigned char>(text(j + m - 1))];
+      if (shift > 0) {
+        j += shift;
+        continue;
+      }
+      ptrdiff_t i = ell + 1;
+      while (i < m && needle(i) == text(i + j)) {
+        ++i;
+      }
+      if (i < m) {
+        j += i - ell;
+        continue;
+      }
+      i = ell;
+      while (i >= 0 && needle(i) == text(i + j)) {
+        --i;
+      }
+      if (i < 0) {
+        return j;
+      }
+      j += period;
+    }
+    return text_sz;
   }
 
-  size_t find_substr(const String& substring, bool is_rfind) const {
-    const char* data_substring = substring.data();
-    size_t first_index = sz;
-    size_t last_index = sz;
-    size_t substring_size = substring.size();
-    if (sz < substring_size) {
-      return sz;
+  // Position before the critical factorization of needle and its period,
+  // taken from the larger of the maximal suffixes under both orders.
+  template <typename NeedleAt>
+  static ptrdiff_t critical_factorization(NeedleAt needle, ptrdiff_t m,
+                                          ptrdiff_t& period) {
+    ptrdiff_t less_period = 0;
+    ptrdiff_t greater_period = 0;
+    ptrdiff_t less = maximal_suffix(needle, m, less_period, false);
+    ptrdiff_t greater = maximal_suffix(needle, m, greater_period, true);
+    if (less > greater) {
+      period = less_period;
+      return less;
     }
-    for (size_t i = 0; i <= sz - substring_size; ++i) {
-      if (memcmp(arr + i, data_substring, sizeof(char) * substring_size) == 0) {
-        if (first_index == sz) {
-          first_index = i;
-          continue;
+    period = greater_period;
+    return greater;
+  }
+
+  template <typename NeedleAt>
+  static ptrdiff_t maximal_suffix(NeedleAt needle, ptrdiff_t m,
+                                  ptrdiff_t& period, bool inverted) {
+    ptrdiff_t suffix = -1;
+    ptrdiff_t j = 0;
+    ptrdiff_t k = 1;
+    period = 1;
+    while (j + k < m) {
+      unsigned char a = needle(j + k);
+      unsigned char b = needle(suffix + k);
+      if (inverted ? a > b : a < b) {
+        j += k;
+        k = 1;
+        period = j - suffix;
+      } else if (a == b) {
+        if (k != period) {
+          ++k;
+        } else {
+          j += period;
+          k = 1;
+        }
+      } else {
+        suffix = j;
+        j = suffix + 1;
+        k = period = 1;
+      }
+    }
+    return suffix;
+  }
+
+  static size_t find_short(const char* text, size_t text_sz,
+                           const char* needle, size_t needle_sz, size_t pos) {
+    if (needle_sz == 1) {
+      const void* hit = memchr(text + pos, needle[0], text_sz - pos);
+      return hit ? static_cast<const char*>(hit) - text : text_sz;
+    }
+    char first = needle[0];
+    char last = needle[needle_sz - 1];
+    size_t i = pos;
+#if defined(__SSE2__)
+    __m128i first_bytes = _mm_set1_epi8(first);
+    __m128i last_bytes = _mm_set1_epi8(last);
+    for (; i + needle_sz + 15 <= text_sz; i += 16) {
+      __m128i head = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text + i));
+      __m128i tail = _mm_loadu_si128(
+          reinterpret_cast<const __m128i*>(text + i + needle_sz - 1));
+      unsigned mask = _mm_movemask_epi8(_mm_and_si128(
+          _mm_cmpeq_epi8(head, first_bytes), _mm_cmpeq_epi8(tail, last_bytes)));
+      while (mask != 0) {
+        size_t at = i + std::countr_zero(mask);
+        if (memcmp(text + at + 1, needle + 1, needle_sz - 2) == 0) {
+          return at;
+        }
+        mask &= mask - 1;
+      }
+    }
+#endif
+    while (i + needle_sz <= text_sz) {
+      const void* hit = memchr(text + i, first, text_sz - needle_sz + 1 - i);
+      if (hit == nullptr) {
+        break;
+      }
+      i = static_cast<const char*>(hit) - text;
+      if (text[i + needle_sz - 1] == last &&
+          memcmp(text + i + 1, needle + 1, needle_sz - 2) == 0) {
+        return i;
+      }
+      ++i;
+    }
+    return text_sz;
+  }
+
+  // Scans candidate starts from pos down to 0.
+  static size_t rfind_short(const char* text, size_t text_sz,
+                            const char* needle, size_t needle_sz, size_t pos) {
+    char first = needle[0];
+    char last = needle[needle_sz - 1];
+    size_t end = pos + 1;
+#if defined(__SSE2__)
+    __m128i first_bytes = _mm_set1_epi8(first);
+    __m128i last_bytes = _mm_set1_epi8(last);
+    for (; end >= 16; end -= 16) {
+      const char* block = text + end - 16;
+      __m128i head = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block));
+      __m128i tail = _mm_loadu_si128(
+          reinterpret_cast<const __m128i*>(block + needle_sz - 1));
+      unsigned mask = _mm_movemask_epi8(_mm_and_si128(
+          _mm_cmpeq_epi8(head, first_bytes), _mm_cmpeq_epi8(tail, last_bytes)));
+      while (mask != 0) {
+        size_t bit = 31 - std::countl_zero(mask);
+        size_t at = end - 16 + bit;
+        if (needle_sz < 2 ||
+            memcmp(text + at + 1, needle + 1, needle_sz - 2) == 0) {
+          return at;
         }
-        last_index = i;
+        mask &= ~(1u << bit);
+      }
+    }
+#endif
+    while (end > 0) {
+      size_t at = --end;
+      if (text[at] == first && text[at + needle_sz - 1] == last &&
+          (needle_sz < 2 ||
+           memcmp(text + at + 1, needle + 1, needle_sz - 2) == 0)) {
+        return at;
+      }
+    }
+    return text_sz;
+  }
+
+ public:
+  // First match starting at or after pos.
+  static size_t find(const char* text, size_t text_sz, const char* needle,
+                     size_t needle_sz, size_t pos = 0) {
+    if (pos > text_sz || needle_sz > text_sz - pos) {
+      return text_sz;
+    }
+    if (needle_sz == 0) {
+      return pos;
+    }
+    if (needle_sz <= short_needle_sz_) {
+      return find_short(text, text_sz, needle, needle_sz, pos);
+    }
+    size_t found = two_way(
+        [text, pos](ptrdiff_t i) { return text[pos + i]; }, text_sz - pos,
+        [needle](ptrdiff_t i) { return needle[i]; }, needle_sz);
+    return found == text_sz - pos ? text_sz : pos + found;
+  }
+
+  // Last match starting at or before pos.
+  static size_t rfind(const char* text, size_t text_sz, const char* needle,
+                      size_t needle_sz, size_t pos = SIZE_MAX) {
+    if (needle_sz > text_sz) {
+      return text_sz;
+    }
+    pos = std::min(pos, text_sz - needle_sz);
+    if (needle_sz == 0) {
+      return pos;
+    }
+    if (needle_sz <= short_needle_sz_) {
+      return rfind_short(text, text_sz, needle, needle_sz, pos);
+    }
+    size_t window = pos + needle_sz;
+    size_t found = two_way(
+        [text, window](ptrdiff_t i) { return text[window - 1 - i]; }, window,
+        [needle, needle_sz](ptrdiff_t i) { return needle[needle_sz - 1 - i]; },
+        needle_sz);
+    return found == window ? text_sz : window - found - needle_sz;
+  }
+};
+
+// 64-bit string hash after wyhash (final version 4). Up to 16 bytes are
+// read with a few overlapping loads; longer inputs are consumed 48 bytes
+// at a time by three independent multiply-xor lanes that the CPU can run
+// in parallel, then 16 bytes at a time. hash(data, size, seed) lets
+// callers pick the seed; SeededStringHash below uses one drawn at random
+// per process, which resists hash flooding.
+class StringHash {
+ private:
+  static constexpr uint64_t secret_[4] = {
+      0xa0761d6478bd642full, 0xe7037ed1a0b428dbull, 0x8ebc6af09c88c6e3ull,
+      0x589965cc75374cc3ull};
+
+  // Replaces a and b with the low and high halves of a * b.
+  static void multiply(uint64_t& a, uint64_t& b) {
+#if defined(__SIZEOF_INT128__)
+    __extension__ typedef unsigned __int128 uint128;
+    uint128 product = static_cast<uint128>(a) * b;
+    a = static_cast<uint64_t>(product);
+    b = static_cast<uint64_t>(product >> 64);
+#else
+    uint64_t a_hi = a >> 32;
+    uint64_t a_lo = static_cast<uint32_t>(a);
+    uint64_t b_hi = b >> 32;
+    uint64_t b_lo = static_cast<uint32_t>(b);
+    uint64_t hh = a_hi * b_hi;
+    uint64_t hl = a_hi * b_lo;
+    uint64_t lh = a_lo * b_hi;
+    uint64_t ll = a_lo * b_lo;
+    uint64_t low = ll + (hl << 32);
+    uint64_t carry = low < ll;
+    uint64_t sum = low + (lh << 32);
+    carry += sum < low;
+    a = sum;
+    b = hh + (hl >> 32) + (lh >> 32) + carry;
+#endif
+  }
+
+  static uint64_t mix(uint64_t a, uint64_t b) {
+    multiply(a, b);
+    return a ^ b;
+  }
+
+  static uint64_t read8(const unsigned char* p) {
+    uint64_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+  }
+
+  static uint64_t read4(const unsigned char* p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+  }
+
+ public:
+  static constexpr uint64_t default_seed = 0;
+
+  static uint64_t hash(const char* data, size_t size,
+                       uint64_t seed = default_seed) {
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(data);
+    seed ^= mix(seed ^ secret_[0], secret_[1]);
+    uint64_t a = 0;
+    uint64_t b = 0;
+    if (size <= 16) {
+      if (size >= 4) {
+        size_t step = (size >> 3) << 2;
+        a = (read4(p) << 32) | read4(p + step);
+        b = (read4(p + size - 4) << 32) | read4(p + size - 4 - step);
+      } else if (size > 0) {
+        a = (uint64_t(p[0]) << 16) | (uint64_t(p[size >> 1]) << 8) |
+            p[size - 1];
+      }
+    } else {
+      size_t left = size;
+      if (left > 48) {
+        uint64_t lane1 = seed;
+        uint64_t lane2 = seed;
+        do {
+          seed = mix(read8(p) ^ secret_[1], read8(p + 8) ^ seed);
+          lane1 = mix(read8(p + 16) ^ secret_[2], read8(p + 24) ^ lane1);
+          lane2 = mix(read8(p + 32) ^ secret_[3], read8(p + 40) ^ lane2);
+          p += 48;
+          left -= 48;
+        } while (left > 48);
+        seed ^= lane1 ^ lane2;
+      }
+      while (left > 16) {
+        seed = mix(read8(p) ^ secret_[1], read8(p + 8) ^ seed);
+        p += 16;
+        left -= 16;
       }
+      a = read8(p + left - 16);
+      b = read8(p + left - 8);
+    }
+    a ^= secret_[1];
+    b ^= seed;
+    multiply(a, b);
+    return mix(a ^ secret_[0] ^ size, b ^ secret_[1]);
+  }
+};
+
+// Non-owning view of a character range. substr, find and rfind never
+// allocate; BasicString converts to StringView implicitly, so the
+// comparison operators below serve String, StringView and string literals
+// alike without building temporaries.
+class StringView {
+ private:
+  const char* arr = nullptr;
+  size_t sz = 0;
+
+ public:
+  StringView() = default;
+
+  StringView(const char* str) : arr(str), sz(strlen(str)) {}
+
+  StringView(const char* str, size_t count) : arr(str), sz(count) {}
+
+  size_t length() const { return sz; }
+
+  size_t size() const { return sz; }
+
+  bool empty() const { return (sz == 0); }
+
+  const char* data() const { return arr; }
+
+  const char& operator[](size_t index) const { return arr[index]; }
+
+  const char& front() const { return arr[0]; }
+
+  const char& back() const { return arr[sz - 1]; }
+
+  StringView substr(size_t start, size_t count = SIZE_MAX) const {
+    return StringView(arr + start, std::min(count, sz - start));
+  }
+
+  void remove_prefix(size_t count) {
+    arr += count;
+    sz -= count;
+  }
+
+  void remove_suffix(size_t count) { sz -= count; }
+
+  // Both return size() when there is no match.
+  size_t find(StringView substring, size_t pos = 0) const {
+    return StringSearch::find(arr, sz, substring.arr, substring.sz, pos);
+  }
+
+  // Last match starting at or before pos.
+  size_t rfind(StringView substring, size_t pos = SIZE_MAX) const {
+    return StringSearch::rfind(arr, sz, substring.arr, substring.sz, pos);
+  }
+
+  friend std::ostream& operator<<(std::ostream& out, StringView view) {
+    out.write(view.arr, view.sz);
+    return out;
+  }
+};
+
+// Views may be empty with a null data(), which memcmp must not be given
+// even for a zero length.
+inline bool operator==(StringView first, StringView second) {
+  if (first.size() != second.size()) {
+    return false;
+  }
+  return first.size() == 0 ||
+         !(memcmp(first.data(), second.data(), sizeof(char) * first.size()));
+}
+
+inline bool operator!=(StringView first, StringView second) {
+  return !(first == second);
+}
+
+inline bool operator<(StringView first, StringView second) {
+  size_t common = std::min(first.size(), second.size());
+  int compare =
+      common == 0 ? 0
+                  : memcmp(first.data(), second.data(), sizeof(char) * common);
+  return compare < 0 || (compare == 0 && (first.size() < second.size()));
+}
+
+inline bool operator>(StringView first, StringView second) {
+  return second < first;
+}
+
+inline bool operator>=(StringView first, StringView second) {
+  return !(first < second);
+}
+
+inline bool operator<=(StringView first, StringView second) {
+  return !(first > second);
+}
+
+template <typename Left, typename Right>
+struct ConcatPieces;
+
+template <typename Left, typename Right>
+class StringConcat;
+
+// Maps an operand type of a concatenation to the piece it is stored as;
+// specialized after BasicString for every supported operand.
+template <typename Operand>
+struct ConcatOperand {
+  static constexpr bool valid = false;
+  static constexpr bool string_like = false;
+};
+
+// Size, characters and copy of one concatenation piece: a view, a char or
+// the ConcatPieces of a nested expression (whose overloads follow its
+// definition and are found by argument-dependent lookup).
+inline size_t concat_piece_size(StringView view) { return view.size(); }
+
+inline size_t concat_piece_size(char) { return 1; }
+
+inline char concat_piece_at(StringView view, size_t index) {
+  return view[index];
+}
+
+inline char concat_piece_at(char symbol, size_t) { return symbol; }
+
+inline char* copy_concat_piece(char* out, StringView view) {
+  return std::copy(view.data(), view.data() + view.size(), out);
+}
+
+inline char* copy_concat_piece(char* out, char symbol) {
+  *out = symbol;
+  return out + 1;
+}
+
+// Whether the piece reads from [first, last).
+inline bool concat_piece_views(StringView view, const char* first,
+                               const char* last) {
+  std::less<const char*> less;
+  return less(view.data(), last) && less(first, view.data() + view.size());
+}
+
+inline bool concat_piece_views(char, const char*, const char*) {
+  return false;
+}
+
+// Short strings (up to local_cap_ characters) are stored inline in the
+// union with cap, so they never allocate. arr always points at the live
+// characters, either buf or a heap block of cap + 1 chars, which keeps
+// data() and operator[] free of branches.
+template <typename Alloc = std::allocator<char>>
+class BasicString {
+ private:
+  template <typename Left, typename Right>
+  friend class StringConcat;
+
+  using AllocTraits = std::allocator_traits<Alloc>;
+
+  static constexpr size_t local_cap_ = 15;
+
+  [[no_unique_address]] Alloc alloc;
+  char* arr = buf;
+  size_t sz = 0;
+  union {
+    size_t cap;
+    char buf[local_cap_ + 1];
+  };
+
+  BasicString(size_t count, const Alloc& alloc, size_t capacity)
+      : alloc(alloc), sz(count) {
+    init_storage(capacity);
+    arr[count] = '\0';
+  }
+
+  bool is_local() const { return arr == buf; }
+
+  // Points arr at storage for capacity chars; arr must not own a block.
+  void init_storage(size_t capacity) {
+    if (capacity <= local_cap_) {
+      arr = buf;
+      return;
+    }
+    arr = AllocTraits::allocate(alloc, capacity + 1);
+    cap = capacity;
+  }
+
+  void release_storage() {
+    if (!is_local()) {
+      AllocTraits::deallocate(alloc, arr, cap + 1);
+    }
+  }
+
+  // Takes other's characters and leaves it empty; arr must not own a block.
+  void steal(BasicString& other) noexcept {
+    sz = other.sz;
+    if (other.is_local()) {
+      arr = buf;
+      std::copy(other.buf, other.buf + other.sz + 1, buf);
+    } else {
+      arr = other.arr;
+      cap = other.cap;
+      other.arr = other.buf;
     }
-    if (is_rfind) {
-      return last_index;
+    other.sz = 0;
+    other.buf[0] = '\0';
+  }
+
+  void reallocate(size_t new_cap) {
+    if (new_cap <= local_cap_) {
+      if (!is_local()) {
+        char* old = arr;
+        size_t old_cap = cap;
+        std::copy(old, old + sz, buf);
+        buf[sz] = '\0';
+        arr = buf;
+        AllocTraits::deallocate(alloc, old, old_cap + 1);
+      }
+      return;
     }
-    return first_index;
+    char* new_string = AllocTraits::allocate(alloc, new_cap + 1);
+    std::copy(arr, arr + sz, new_string);
+    new_string[sz] = '\0';
+    release_storage();
+    arr = new_string;
+    cap = new_cap;
   }
 
  public:
-  String() = default;
+  using allocator_type = Alloc;
+
+  BasicString() : BasicString(Alloc()) {}
+
+  explicit BasicString(const Alloc& alloc) : BasicString(0, alloc, 0) {}
 
-  String(char symbol) : String(1, symbol) {}
+  BasicString(char symbol, const Alloc& alloc = Alloc())
+      : BasicString(1, symbol, alloc) {}
 
-  String(const char* str) : String(strlen(str)) {
+  BasicString(const char* str, const Alloc& alloc = Alloc())
+      : BasicString(strlen(str), alloc, strlen(str)) {
     std::copy(str, str + sz, arr);
   }
 
-  String(size_t count, char symbol) : String(count) {
+  BasicString(size_t count, char symbol, const Alloc& alloc = Alloc())
+      : BasicString(count, alloc, count) {
     std::fill(arr, arr + count, symbol);
   }
 
-  String(const String& other) : String(other.sz) {
+  BasicString(const BasicString& other)
+      : BasicString(other.sz,
+                    AllocTraits::select_on_container_copy_construction(
+                        other.alloc),
+                    other.sz) {
     std::copy(other.arr, other.arr + sz, arr);
   }
 
+  BasicString(const BasicString& other, const Alloc& alloc)
+      : BasicString(other.sz, alloc, other.sz) {
+    std::copy(other.arr, other.arr + sz, arr);
+  }
+
+  explicit BasicString(StringView view, const Alloc& alloc = Alloc())
+      : BasicString(view.size(), alloc, view.size()) {
+    std::copy(view.data(), view.data() + sz, arr);
+  }
+
+  BasicString(BasicString&& other) noexcept : alloc(std::move(other.alloc)) {
+    steal(other);
+  }
+
+  Alloc get_allocator() const { return alloc; }
+
   size_t length() const { return sz; }
 
   size_t size() const { return sz; }
 
-  size_t capacity() const { return cap; }
+  size_t capacity() const { return is_local() ? local_cap_ : cap; }
 
   void pop_back() {
     --sz;
@@ -65,12 +656,8 @@ class String {
   }
 
   void push_back(char symbol) {
-    if (sz == cap) {
-      cap *= 2;
-      char* copy_string = new char[cap + 1];
-      std::copy(arr, arr + sz, copy_string);
-      delete[] arr;
-      arr = copy_string;
+    if (sz == capacity()) {
+      reallocate(2 * capacity());
     }
     arr[sz] = symbol;
     ++sz;
@@ -88,41 +675,48 @@ class String {
   bool empty() const { return (sz == 0); }
 
   void clear() {
-    if (cap == 0) {
-      arr = new char[1];
-    }
     sz = 0;
     arr[sz] = '\0';
   }
 
-  String substr(size_t start, size_t count) const {
+  BasicString substr(size_t start, size_t count) const {
     count = std::min(count, sz - start);
-    String new_string = String(count);
+    BasicString new_string(count, alloc, count);
     std::copy(arr + start, arr + start + count, new_string.arr);
     return new_string;
   }
 
-  void shrink_to_fit() {
-    char* new_string = new char[sz + 1];
-    std::copy(arr, arr + sz, new_string);
-    new_string[sz] = '\0';
-    delete[] arr;
-    arr = new_string;
-    cap = sz;
+  void reserve(size_t new_cap) {
+    if (new_cap > capacity()) {
+      reallocate(new_cap);
+    }
   }
 
+  void shrink_to_fit() { reallocate(sz); }
+
   char* data() { return arr; }
 
   const char* data() const { return arr; }
 
-  String& operator=(const String& other) {
+  operator StringView() const { return StringView(arr, sz); }
+
+  BasicString& operator=(const BasicString& other) {
     if (this == &other) {
       return *this;
     }
-    if (cap < other.sz) {
-      delete[] arr;
-      arr = new char[other.cap + 1];
-      cap = other.cap;
+    if constexpr (AllocTraits::propagate_on_container_copy_assignment::value) {
+      if (alloc != other.alloc) {
+        release_storage();
+        arr = buf;
+        sz = 0;
+        alloc = other.alloc;
+      }
+    }
+    if (capacity() < other.sz) {
+      release_storage();
+      arr = buf;
+      sz = 0;
+      init_storage(other.capacity());
     }
     std::copy(other.arr, other.arr + other.sz, arr);
     sz = other.sz;
@@ -130,26 +724,70 @@ class String {
     return *this;
   }
 
-  String& operator+=(char symbol) {
+  // Steals other's buffer when the allocator propagates or compares equal,
+  // otherwise copies the characters into this string's own storage.
+  BasicString& operator=(BasicString&& other) noexcept(
+      AllocTraits::propagate_on_container_move_assignment::value ||
+      AllocTraits::is_always_equal::value) {
+    if (this == &other) {
+      return *this;
+    }
+    if constexpr (AllocTraits::propagate_on_container_move_assignment::value) {
+      release_storage();
+      alloc = std::move(other.alloc);
+    } else {
+      if (alloc != other.alloc) {
+        return *this = other;
+      }
+      release_storage();
+    }
+    steal(other);
+    return *this;
+  }
+
+  BasicString& operator+=(char symbol) {
     push_back(symbol);
     return *this;
   }
 
-  String& operator+=(const String& other) {
-    if (cap < sz + other.sz) {
-      cap = std::max(sz + other.sz, 2 * cap);
-      char* new_string = new char[cap + 1];
+  BasicString& operator+=(StringView other) {
+    size_t new_sz = sz + other.size();
+    if (capacity() < new_sz) {
+      // other may view this string, so it is copied before the old storage
+      // is released.
+      size_t new_cap = std::max(new_sz, 2 * capacity());
+      char* new_string = AllocTraits::allocate(alloc, new_cap + 1);
+      std::copy(arr, arr + sz, new_string);
+      std::copy(other.data(), other.data() + other.size(), new_string + sz);
+      release_storage();
+      arr = new_string;
+      cap = new_cap;
+    } else {
+      std::copy(other.data(), other.data() + other.size(), arr + sz);
+    }
+    sz = new_sz;
+    arr[sz] = '\0';
+    return *this;
+  }
+
+  // The pieces may view this string, so they are copied before the old
+  // storage is released.
+  template <typename Left, typename Right>
+  BasicString& operator+=(const ConcatPieces<Left, Right>& concat) {
+    size_t new_sz = sz + concat.size();
+    if (capacity() < new_sz) {
+      size_t new_cap = std::max(new_sz, 2 * capacity());
+      char* new_string = AllocTraits::allocate(alloc, new_cap + 1);
       std::copy(arr, arr + sz, new_string);
-      std::copy(other.arr, other.arr + other.sz, new_string + sz);
-      sz += other.sz;
-      new_string[sz] = '\0';
-      delete[] arr;
+      concat.copy_to(new_string + sz);
+      release_storage();
       arr = new_string;
+      cap = new_cap;
     } else {
-      std::copy(other.arr, other.arr + other.sz, arr + sz);
-      sz += other.sz;
-      arr[sz] = '\0';
+      concat.copy_to(arr + sz);
     }
+    sz = new_sz;
+    arr[sz] = '\0';
     return *this;
   }
 
@@ -157,65 +795,284 @@ class String {
 
   const char& operator[](size_t index) const { return arr[index]; }
 
-  size_t find(const String& substring) const {
-    return find_substr(substring, false);
+  // Both return size() when there is no match.
+  size_t find(StringView substring, size_t pos = 0) const {
+    return StringSearch::find(arr, sz, substring.data(), substring.size(),
+                              pos);
+  }
+
+  // Last match starting at or before pos.
+  size_t rfind(StringView substring, size_t pos = SIZE_MAX) const {
+    return StringSearch::rfind(arr, sz, substring.data(), substring.size(),
+                               pos);
+  }
+
+  ~BasicString() { release_storage(); }
+
+  friend std::istream& operator>>(std::istream& in, BasicString& other) {
+    other.clear();
+    char temp = in.get();
+    while ((temp < '!') || (temp > '~')) {
+      temp = in.get();
+    }
+    while ((temp >= '!') && (temp <= '~')) {
+      other += temp;
+      temp = in.get();
+    }
+    return in;
+  }
+
+  friend std::ostream& operator<<(std::ostream& out, const BasicString& other) {
+    out << other.data();
+    return out;
+  }
+
+  // Concatenating lvalues builds a StringConcat (below). The rvalue
+  // overloads instead build the result in an operand's storage, so a chain
+  // that starts from a temporary String appends in place.
+  template <typename Right,
+            typename RightOperand = ConcatOperand<std::decay_t<Right>>>
+    requires(RightOperand::valid)
+  friend BasicString operator+(BasicString&& first, const Right& second) {
+    first += typename RightOperand::Piece(second);
+    return std::move(first);
   }
 
-  size_t rfind(const String& substring) const {
-    return find_substr(substring, true);
+  friend BasicString operator+(BasicString&& first, BasicString&& second) {
+    first += second;
+    return std::move(first);
   }
 
-  ~String() { delete[] arr; }
+  template <typename Left,
+            typename LeftOperand = ConcatOperand<std::decay_t<Left>>>
+    requires(LeftOperand::valid)
+  friend BasicString operator+(const Left& first, BasicString&& second) {
+    typename LeftOperand::Piece piece(first);
+    size_t piece_sz = concat_piece_size(piece);
+    // Shifting second would overwrite a piece that views it.
+    if (second.capacity() < piece_sz + second.sz ||
+        concat_piece_views(piece, second.arr, second.arr + second.sz)) {
+      return StringConcat<typename LeftOperand::Piece, StringView>(piece,
+                                                                   second);
+    }
+    std::copy_backward(second.arr, second.arr + second.sz + 1,
+                       second.arr + piece_sz + second.sz + 1);
+    copy_concat_piece(second.arr, piece);
+    second.sz += piece_sz;
+    return std::move(second);
+  }
+};
+
+using String = BasicString<>;
+
+// Lazy concatenation: a + b + c over String, StringView, C strings and
+// chars builds a tree of views and chars instead of temporaries. Converting
+// it to a String sums the piece sizes, allocates once and copies every
+// piece once. The expression only views its operands, so it must be
+// converted before they go away; it is meant to be used as a temporary and
+// not held in an auto variable.
+template <typename Alloc>
+struct ConcatOperand<BasicString<Alloc>> {
+  static constexpr bool valid = true;
+  static constexpr bool string_like = true;
+  using Piece = StringView;
+};
+
+template <>
+struct ConcatOperand<StringView> {
+  static constexpr bool valid = true;
+  static constexpr bool string_like = true;
+  using Piece = StringView;
+};
+
+template <typename Left, typename Right>
+struct ConcatOperand<StringConcat<Left, Right>> {
+  static constexpr bool valid = true;
+  static constexpr bool string_like = true;
+  using Piece = ConcatPieces<Left, Right>;
+};
+
+template <>
+struct ConcatOperand<const char*> {
+  static constexpr bool valid = true;
+  static constexpr bool string_like = false;
+  using Piece = StringView;
 };
 
-std::istream& operator>>(std::istream& in, String& other) {
-  other.clear();
-  char temp = in.get();
-  while ((temp < '!') || (temp > '~')) {
-    temp = in.get();
+template <>
+struct ConcatOperand<char*> : ConcatOperand<const char*> {};
+
+template <>
+struct ConcatOperand<char> {
+  static constexpr bool valid = true;
+  static constexpr bool string_like = false;
+  using Piece = char;
+};
+
+// The two pieces of a concatenation. A nested StringConcat is stored as
+// its ConcatPieces, so only the outermost expression carries a cache.
+template <typename Left, typename Right>
+struct ConcatPieces {
+  Left left;
+  Right right;
+
+  size_t size() const {
+    return concat_piece_size(left) + concat_piece_size(right);
   }
-  while ((temp >= '!') && (temp <= '~')) {
-    other += temp;
-    temp = in.get();
+
+  char operator[](size_t index) const {
+    size_t left_sz = concat_piece_size(left);
+    return index < left_sz ? concat_piece_at(left, index)
+                           : concat_piece_at(right, index - left_sz);
   }
-  return in;
-}
 
-std::ostream& operator<<(std::ostream& out, const String& other) {
-  out << other.data();
-  return out;
-}
+  bool views(const char* first, const char* last) const {
+    return concat_piece_views(left, first, last) ||
+           concat_piece_views(right, first, last);
+  }
 
-String operator+(const String& first, const String& second) {
-  String result = first;
-  result += second;
-  return result;
-}
+  // Writes the pieces to out and returns the end of what was written.
+  char* copy_to(char* out) const {
+    return copy_concat_piece(copy_concat_piece(out, left), right);
+  }
+};
 
-bool operator==(const String& first, const String& second) {
-  return (first.size() == second.size()) &&
-         !(memcmp(first.data(), second.data(),
-                  sizeof(char) * std::min(first.size(), second.size())));
+template <typename Left, typename Right>
+size_t concat_piece_size(const ConcatPieces<Left, Right>& pieces) {
+  return pieces.size();
 }
 
-bool operator!=(const String& first, const String& second) {
-  return !(first == second);
+template <typename Left, typename Right>
+char concat_piece_at(const ConcatPieces<Left, Right>& pieces, size_t index) {
+  return pieces[index];
 }
 
-bool operator<(const String& first, const String& second) {
-  int compare = memcmp(first.data(), second.data(),
-                       sizeof(char) * std::min(first.size(), second.size()));
-  return compare < 0 || (compare == 0 && (first.size() < second.size()));
+template <typename Left, typename Right>
+char* copy_concat_piece(char* out, const ConcatPieces<Left, Right>& pieces) {
+  return pieces.copy_to(out);
 }
 
-bool operator>(const String& first, const String& second) {
-  return second < first;
+template <typename Left, typename Right>
+bool concat_piece_views(const ConcatPieces<Left, Right>& pieces,
+                        const char* first, const char* last) {
+  return pieces.views(first, last);
 }
 
-bool operator>=(const String& first, const String& second) {
-  return !(first < second);
+template <typename Left, typename Right>
+class [[nodiscard]] StringConcat : public ConcatPieces<Left, Right> {
+ private:
+  // Built on first use by the members that need contiguous text.
+  mutable std::optional<String> text_;
+
+  template <typename Alloc>
+  BasicString<Alloc> build() const {
+    size_t total = this->size();
+    BasicString<Alloc> result(total, Alloc(), total);
+    this->copy_to(result.arr);
+    return result;
+  }
+
+  const String& materialize() const {
+    if (!text_) {
+      text_.emplace(build<std::allocator<char>>());
+    }
+    return *text_;
+  }
+
+ public:
+  StringConcat(Left first, Right second)
+      : ConcatPieces<Left, Right>{first, second} {}
+
+  size_t length() const { return this->size(); }
+
+  bool empty() const { return this->size() == 0; }
+
+  char front() const { return (*this)[0]; }
+
+  char back() const { return (*this)[this->size() - 1]; }
+
+  // The members below read the String that the expression builds on first
+  // use, so data() stays valid as long as the expression.
+  const char* data() const { return materialize().data(); }
+
+  String substr(size_t start, size_t count) const {
+    return materialize().substr(start, count);
+  }
+
+  size_t find(StringView substring, size_t pos = 0) const {
+    return materialize().find(substring, pos);
+  }
+
+  size_t rfind(StringView substring, size_t pos = SIZE_MAX) const {
+    return materialize().rfind(substring, pos);
+  }
+
+  // The conversions only take a temporary expression, so one held in a
+  // variable has to be std::move'd, which flags that its operands must
+  // still be alive.
+  template <typename Alloc>
+  operator BasicString<Alloc>() const&& {
+    return build<Alloc>();
+  }
+
+  // Lets an expression reach StringView parameters and comparisons. The
+  // view points into the expression, so it lasts as long as the temporary.
+  operator StringView() const&& { return materialize(); }
+
+  friend std::ostream& operator<<(std::ostream& out,
+                                  const StringConcat& concat) {
+    return out << concat.materialize();
+  }
+};
+
+template <typename Left, typename Right,
+          typename LeftOperand = ConcatOperand<std::decay_t<Left>>,
+          typename RightOperand = ConcatOperand<std::decay_t<Right>>>
+  requires(LeftOperand::valid && RightOperand::valid &&
+           (LeftOperand::string_like || RightOperand::string_like))
+StringConcat<typename LeftOperand::Piece, typename RightOperand::Piece>
+operator+(const Left& first, const Right& second) {
+  return {typename LeftOperand::Piece(first),
+          typename RightOperand::Piece(second)};
 }
 
-bool operator<=(const String& first, const String& second) {
-  return !(first > second);
-}
\ No newline at end of file
+// Hasher for UnorderedMap keys that may come from untrusted input. The
+// seed is random per process, so every instance (and every copy of a map)
+// agrees on it.
+struct SeededStringHash {
+  uint64_t seed;
+
+  SeededStringHash() : seed(process_seed()) {}
+
+  explicit SeededStringHash(uint64_t hash_seed) : seed(hash_seed) {}
+
+  static uint64_t process_seed() {
+    static const uint64_t seed = [] {
+      std::random_device device;
+      return (uint64_t(device()) << 32) ^ device();
+    }();
+    return seed;
+  }
+
+  size_t operator()(StringView view) const {
+    return StringHash::hash(view.data(), view.size(), seed);
+  }
+};
+
+namespace std {
+
+template <typename Alloc>
+struct hash<BasicString<Alloc>> {
+  size_t operator()(StringView view) const {
+    return StringHash::hash(view.data(), view.size());
+  }
+};
+
+template <>
+struct hash<StringView> {
+  size_t operator()(StringView view) const {
+    return StringHash::hash(view.data(), view.size());
+  }
+};
+
+}  // namespace std
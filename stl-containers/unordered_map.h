@@ -116,10 +116,7 @@ class List {
     }
   }
 
-  explicit List(const Alloc& alloc = Alloc())
-      : alloc_(
-            std::allocator_traits<Alloc>::select_on_container_copy_construction(
-                alloc)) {
+  explicit List(const Alloc& alloc = Alloc()) : alloc_(alloc) {
     construct_fake_node();
   }
 
@@ -459,12 +456,17 @@ class UnorderedMap {
 
   void max_load_factor(float ml) { max_load_factor_ = ml; }
 
-  UnorderedMap() : alloc_(Allocator()), hash_table_(alloc_), list_(alloc_) {
+  UnorderedMap() : UnorderedMap(Allocator()) {}
+
+  explicit UnorderedMap(const Allocator& alloc)
+      : alloc_(alloc), hash_table_(alloc_), list_(alloc_) {
     reserve(start_bucket_count_);
   }
 
   UnorderedMap(const UnorderedMap& other)
-      : alloc_(
+      : hash_(other.hash_),
+        equal_(other.equal_),
+        alloc_(
             AllocTraits::select_on_container_copy_construction(other.alloc_)),
         hash_table_(alloc_),
         list_(other.list_) {
@@ -472,7 +474,9 @@ class UnorderedMap {
   }
 
   UnorderedMap(UnorderedMap&& other)
-      : alloc_(std::move(other.alloc_)),
+      : hash_(std::move(other.hash_)),
+        equal_(std::move(other.equal_)),
+        alloc_(std::move(other.alloc_)),
         hash_table_(std::move(other.hash_table_)),
         list_(std::move(other.list_)) {
     reserve(other.hash_table_.size());
@@ -552,9 +556,10 @@ class UnorderedMap {
         return {hash_table_[index], false};
       }
     }
+    // No free slot within reach: grow. The rebuilt table already holds
+    // new_element, whose key was moved out of args.
     reserve(hash_table_.size() * 2);
-    list_.erase(--list_.cend());
-    return emplace(std::forward<Args>(args)...);
+    return {new_element, true};
   }
 
   void insert(const NodeType& node) { emplace(node); }
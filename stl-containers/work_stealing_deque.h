@@ -0,0 +1,391 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "deque.h"
+
+// Chase-Lev work-stealing deque (with the C11 orderings of Le et al.,
+// "Correct and Efficient Work-Stealing for Weak Memory Models"). The owner
+// thread pushes and pops at the back; any thread may steal from the front.
+// Elements live in a circular power-of-two buffer addressed with a mask,
+// like Deque's blocks. Growing copies the live range into a buffer twice
+// the size and publishes it; thieves may still be reading the old one, so
+// replaced buffers are kept on a retired chain and freed by the destructor.
+// Their total size never exceeds that of the current buffer.
+template <typename T, typename Alloc = std::allocator<T>>
+class WorkStealingDeque {
+ private:
+  static_assert(std::is_trivially_copyable<T>::value,
+                "WorkStealingDeque elements are read racily and must be "
+                "trivially copyable");
+
+  using Slot = std::atomic<T>;
+
+  struct Buffer {
+    size_t mask;
+    Slot* slots;
+    Buffer* retired;
+
+    T load(int64_t index) const {
+      return slots[index & mask].load(std::memory_order_relaxed);
+    }
+
+    void store(int64_t index, T value) {
+      slots[index & mask].store(value, std::memory_order_relaxed);
+    }
+  };
+
+  using BufferAlloc =
+      typename std::allocator_traits<Alloc>::template rebind_alloc<Buffer>;
+  using BufferTraits = typename std::allocator_traits<BufferAlloc>;
+  using SlotAlloc =
+      typename std::allocator_traits<Alloc>::template rebind_alloc<Slot>;
+  using SlotTraits = typename std::allocator_traits<SlotAlloc>;
+
+  static constexpr size_t cache_line_sz_ = 64;
+
+  alignas(cache_line_sz_) std::atomic<int64_t> front_ = 0;
+  alignas(cache_line_sz_) std::atomic<int64_t> back_ = 0;
+  std::atomic<Buffer*> buffer_;
+  [[no_unique_address]] Alloc alloc_;
+
+  Buffer* allocate_buffer(size_t capacity, Buffer* retired) {
+    BufferAlloc buffer_alloc = alloc_;
+    SlotAlloc slot_alloc = alloc_;
+    Buffer* buffer = BufferTraits::allocate(buffer_alloc, 1);
+    try {
+      buffer->slots = SlotTraits::allocate(slot_alloc, capacity);
+    } catch (...) {
+      BufferTraits::deallocate(buffer_alloc, buffer, 1);
+      throw;
+    }
+    for (size_t i = 0; i < capacity; ++i) {
+      new (&buffer->slots[i]) Slot();
+    }
+    buffer->mask = capacity - 1;
+    buffer->retired = retired;
+    return buffer;
+  }
+
+  void deallocate_buffer(Buffer* buffer) {
+    BufferAlloc buffer_alloc = alloc_;
+    SlotAlloc slot_alloc = alloc_;
+    SlotTraits::deallocate(slot_alloc, buffer->slots, buffer->mask + 1);
+    BufferTraits::deallocate(buffer_alloc, buffer, 1);
+  }
+
+  Buffer* grow(Buffer* buffer, int64_t front, int64_t back) {
+    Buffer* bigger = allocate_buffer(2 * (buffer->mask + 1), buffer);
+    for (int64_t i = front; i < back; ++i) {
+      bigger->store(i, buffer->load(i));
+    }
+    buffer_.store(bigger, std::memory_order_release);
+    return bigger;
+  }
+
+ public:
+  using value_type = T;
+
+  explicit WorkStealingDeque(size_t capacity = 64,
+                             const Alloc& alloc = Alloc())
+      : alloc_(alloc) {
+    size_t buffer_sz = 1;
+    while (buffer_sz < capacity) {
+      buffer_sz *= 2;
+    }
+    buffer_.store(allocate_buffer(buffer_sz, nullptr),
+                  std::memory_order_relaxed);
+  }
+
+  WorkStealingDeque(const WorkStealingDeque&) = delete;
+
+  WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+
+  Alloc get_allocator() const { return alloc_; }
+
+  // Owner thread only.
+  void push_back(T value) {
+    int64_t back = back_.load(std::memory_order_relaxed);
+    int64_t front = front_.load(std::memory_order_acquire);
+    Buffer* buffer = buffer_.load(std::memory_order_relaxed);
+    if (back - front > static_cast<int64_t>(buffer->mask)) {
+      buffer = grow(buffer, front, back);
+    }
+    buffer->store(back, value);
+    back_.store(back + 1, std::memory_order_release);
+  }
+
+  // Owner thread only. Returns false when the deque is empty or a thief
+  // took the last element first.
+  bool try_pop_back(T& value) {
+    int64_t back = back_.load(std::memory_order_relaxed) - 1;
+    Buffer* buffer = buffer_.load(std::memory_order_relaxed);
+    back_.store(back, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t front = front_.load(std::memory_order_relaxed);
+    if (front > back) {
+      back_.store(back + 1, std::memory_order_relaxed);
+      return false;
+    }
+    value = buffer->load(back);
+    if (front == back) {
+      bool won = front_.compare_exchange_strong(
+          front, front + 1, std::memory_order_seq_cst,
+          std::memory_order_relaxed);
+      back_.store(back + 1, std::memory_order_relaxed);
+      return won;
+    }
+    return true;
+  }
+
+  // Any thread. Returns false when the deque is empty or another thread
+  // won the race for the front element.
+  bool try_steal(T& value) {
+    int64_t front = front_.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t back = back_.load(std::memory_order_acquire);
+    if (front >= back) {
+      return false;
+    }
+    Buffer* buffer = buffer_.load(std::memory_order_acquire);
+    T stolen = buffer->load(front);
+    if (!front_.compare_exchange_strong(front, front + 1,
+                                        std::memory_order_seq_cst,
+                                        std::memory_order_relaxed)) {
+      return false;
+    }
+    value = stolen;
+    return true;
+  }
+
+  // Approximate unless called by the owner with no thieves running.
+  size_t size() const {
+    int64_t back = back_.load(std::memory_order_relaxed);
+    int64_t front = front_.load(std::memory_order_relaxed);
+    return back > front ? back - front : 0;
+  }
+
+  bool empty() const { return size() == 0; }
+
+  ~WorkStealingDeque() {
+    Buffer* buffer = buffer_.load(std::memory_order_relaxed);
+    while (buffer != nullptr) {
+      Buffer* retired = buffer->retired;
+      deallocate_buffer(buffer);
+      buffer = retired;
+    }
+  }
+};
+
+// Fork/join scheduler on one WorkStealingDeque per worker. Tasks spawned
+// from a worker go to its own deque; tasks spawned from other threads go
+// to a shared injection queue. A thread waiting on a TaskGroup keeps
+// running tasks until the group drains, so nested fork/join never blocks a
+// worker.
+class TaskGroup {
+ private:
+  friend class WorkStealingPool;
+
+  std::atomic<size_t> pending_ = 0;
+  std::mutex error_mutex_;
+  std::exception_ptr error_;
+
+  void set_exception(std::exception_ptr error) {
+    std::lock_guard<std::mutex> lock(error_mutex_);
+    if (error_ == nullptr) {
+      error_ = error;
+    }
+  }
+
+ public:
+  TaskGroup() = default;
+
+  TaskGroup(const TaskGroup&) = delete;
+
+  TaskGroup& operator=(const TaskGroup&) = delete;
+};
+
+class WorkStealingPool {
+ private:
+  struct Task {
+    TaskGroup* group;
+
+    explicit Task(TaskGroup* task_group) : group(task_group) {}
+
+    virtual void run() = 0;
+
+    virtual ~Task() = default;
+  };
+
+  template <typename Function>
+  struct FunctionTask : Task {
+    Function func;
+
+    FunctionTask(TaskGroup* task_group, Function&& function)
+        : Task(task_group), func(std::move(function)) {}
+
+    void run() override { func(); }
+  };
+
+  struct Worker {
+    WorkStealingDeque<Task*> tasks;
+    std::thread thread;
+  };
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+  Deque<Task*> injected_;
+  std::mutex injected_mutex_;
+  std::condition_variable wake_;
+  std::atomic<size_t> queued_ = 0;
+  std::atomic<size_t> sleepers_ = 0;
+  std::atomic<bool> stop_ = false;
+
+  static size_t& worker_index() {
+    thread_local size_t index = SIZE_MAX;
+    return index;
+  }
+
+  static WorkStealingPool*& worker_pool() {
+    thread_local WorkStealingPool* pool = nullptr;
+    return pool;
+  }
+
+  size_t current_worker() const {
+    return worker_pool() == this ? worker_index() : SIZE_MAX;
+  }
+
+  void enqueue(Task* task) {
+    size_t self = current_worker();
+    if (self != SIZE_MAX) {
+      workers_[self]->tasks.push_back(task);
+    } else {
+      std::lock_guard<std::mutex> lock(injected_mutex_);
+      injected_.push_back(task);
+    }
+    queued_.fetch_add(1, std::memory_order_seq_cst);
+    if (sleepers_.load(std::memory_order_seq_cst) > 0) {
+      std::lock_guard<std::mutex> lock(injected_mutex_);
+      wake_.notify_one();
+    }
+  }
+
+  Task* take_injected() {
+    std::lock_guard<std::mutex> lock(injected_mutex_);
+    if (injected_.size() == 0) {
+      return nullptr;
+    }
+    Task* task = injected_[0];
+    injected_.pop_front();
+    return task;
+  }
+
+  Task* find_task(size_t self) {
+    Task* task = nullptr;
+    if (self != SIZE_MAX && workers_[self]->tasks.try_pop_back(task)) {
+      return task;
+    }
+    size_t count = workers_.size();
+    size_t start = self == SIZE_MAX ? 0 : self + 1;
+    for (size_t i = 0; i < count; ++i) {
+      size_t victim = (start + i) % count;
+      if (victim != self && workers_[victim]->tasks.try_steal(task)) {
+        return task;
+      }
+    }
+    return take_injected();
+  }
+
+  void execute(Task* task) {
+    queued_.fetch_sub(1, std::memory_order_relaxed);
+    TaskGroup* group = task->group;
+    try {
+      task->run();
+    } catch (...) {
+      group->set_exception(std::current_exception());
+    }
+    delete task;
+    group->pending_.fetch_sub(1, std::memory_order_release);
+  }
+
+  void work(size_t self) {
+    worker_pool() = this;
+    worker_index() = self;
+    while (!stop_.load(std::memory_order_acquire)) {
+      if (Task* task = find_task(self)) {
+        execute(task);
+        continue;
+      }
+      std::unique_lock<std::mutex> lock(injected_mutex_);
+      sleepers_.fetch_add(1, std::memory_order_seq_cst);
+      wake_.wait(lock, [this] {
+        return stop_.load(std::memory_order_acquire) ||
+               queued_.load(std::memory_order_seq_cst) > 0;
+      });
+      sleepers_.fetch_sub(1, std::memory_order_relaxed);
+    }
+  }
+
+ public:
+  explicit WorkStealingPool(
+      size_t threads = std::max(1u, std::thread::hardware_concurrency())) {
+    for (size_t i = 0; i < threads; ++i) {
+      workers_.push_back(std::make_unique<Worker>());
+    }
+    for (size_t i = 0; i < threads; ++i) {
+      workers_[i]->thread = std::thread([this, i] { work(i); });
+    }
+  }
+
+  WorkStealingPool(const WorkStealingPool&) = delete;
+
+  WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+  size_t size() const { return workers_.size(); }
+
+  template <typename Function>
+  void spawn(TaskGroup& group, Function func) {
+    Task* task = new FunctionTask<Function>(&group, std::move(func));
+    group.pending_.fetch_add(1, std::memory_order_relaxed);
+    enqueue(task);
+  }
+
+  // Runs queued tasks until every task spawned into group has finished,
+  // then rethrows the first exception one of them threw.
+  void wait(TaskGroup& group) {
+    size_t self = current_worker();
+    while (group.pending_.load(std::memory_order_acquire) > 0) {
+      if (Task* task = find_task(self)) {
+        execute(task);
+      } else {
+        std::this_thread::yield();
+      }
+    }
+    if (group.error_ != nullptr) {
+      std::exception_ptr error = group.error_;
+      group.error_ = nullptr;
+      std::rethrow_exception(error);
+    }
+  }
+
+  ~WorkStealingPool() {
+    {
+      std::lock_guard<std::mutex> lock(injected_mutex_);
+      stop_.store(true, std::memory_order_release);
+    }
+    wake_.notify_all();
+    for (auto& worker : workers_) {
+      worker->thread.join();
+    }
+  }
+};